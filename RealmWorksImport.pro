@@ -11,7 +11,7 @@ VERSION = 2.18
 include (3rdparty/QtXlsxWriter/src/xlsx/qtxlsx.pri)
 include (3rdparty/yaml-cpp/yaml-cpp.pri)
 
-QT       += core gui network xmlpatterns qml
+QT       += core gui network xmlpatterns qml concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -28,7 +28,11 @@ DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x051200
 
 SOURCES += main.cpp \
     addcolumndialog.cpp \
+    batchexport.cpp \
+    batchrunner.cpp \
     columnnamemodel.cpp \
+    datamodelloader.cpp \
+    derivedcolumnfunctions.cpp \
     derivedcolumnsproxymodel.cpp \
     jsonmodel.cpp \
     jsontreemodel.cpp \
@@ -60,12 +64,26 @@ SOURCES += main.cpp \
     rw_relationship.cpp \
     rw_relationship_widget.cpp \
     errordialog.cpp \
+    exportlog.cpp \
+    exportcontext.cpp \
+    assetcache.cpp \
+    base64encoder.cpp \
+    incrementalstate.cpp \
+    urlassetfetcher.cpp \
+    imagetransformer.cpp \
+    exportvalidator.cpp \
+    projectfile.cpp \
+    urllinks.cpp \
     yamlmodel.cpp
 
 HEADERS  += mainwindow.h \
     addcolumndialog.h \
+    batchexport.h \
+    batchrunner.h \
     columnnamemodel.h \
     csvmodel.h \
+    datamodelloader.h \
+    derivedcolumnfunctions.h \
     derivedcolumnsproxymodel.h \
     jsonmodel.h \
     jsontreemodel.h \
@@ -96,6 +114,16 @@ HEADERS  += mainwindow.h \
     rw_relationship.h \
     rw_relationship_widget.h \
     errordialog.h \
+    exportlog.h \
+    exportcontext.h \
+    assetcache.h \
+    base64encoder.h \
+    incrementalstate.h \
+    urlassetfetcher.h \
+    imagetransformer.h \
+    exportvalidator.h \
+    projectfile.h \
+    urllinks.h \
     yamlmodel.h
 
 FORMS    += mainwindow.ui \
@@ -33,6 +33,11 @@ void AddColumnDialog::setExpression(const QString &expression)
     ui->expression->setText(expression);
 }
 
+void AddColumnDialog::setBatch(bool batch)
+{
+    ui->batchFunction->setChecked(batch);
+}
+
 void AddColumnDialog::on_columnNames_activated(const QString &column)
 {
     emit requestExpression(column);
@@ -62,7 +67,7 @@ void AddColumnDialog::on_okButton_clicked()
 
 void AddColumnDialog::on_applyButton_clicked()
 {
-    emit updateColumn(ui->columnNames->currentText(), ui->expression->toPlainText());
+    emit updateColumn(ui->columnNames->currentText(), ui->expression->toPlainText(), ui->batchFunction->isChecked());
     emit requestColumnNames();
 }
 
@@ -22,9 +22,10 @@ public:
 public slots:
     void setColumnNames(const QStringList&);
     void setExpression(const QString&);
+    void setBatch(bool);
 
 Q_SIGNALS:
-    void updateColumn(const QString &name, const QString &expression);
+    void updateColumn(const QString &name, const QString &expression, bool batch);
     void deleteColumn(const QString &name);
     void requestExpression(const QString &name);
     void requestColumnNames();
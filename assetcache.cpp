@@ -0,0 +1,228 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "assetcache.h"
+#include "base64encoder.h"
+
+#include <QDateTime>
+#include <QBuffer>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryFile>
+#include <QtConcurrent>
+
+AssetCache::AssetCache(qint64 memory_budget) :
+    p_memory_budget(memory_budget)
+{
+}
+
+AssetCache::~AssetCache()
+{
+    delete spill_file;
+}
+
+/**
+ * @brief AssetCache::entry
+ * @param key
+ * @return the (possibly not yet loaded) entry for the key
+ */
+QSharedPointer<AssetCache::Entry> AssetCache::entry(const QString &key)
+{
+    QMutexLocker lock(&mutex);
+    QSharedPointer<Entry> &result = entries[key];
+    if (result.isNull()) result.reset(new Entry);
+    return result;
+}
+
+/**
+ * @brief AssetCache::load
+ * Reads and encodes the file, unless it has already been done (or is being done by another thread).
+ * @param info the asset file
+ * @return the entry for the file, or nullptr if it isn't a file.
+ */
+QSharedPointer<AssetCache::Entry> AssetCache::load(const QFileInfo &info)
+{
+    if (!info.isFile()) return QSharedPointer<Entry>();
+
+    QSharedPointer<Entry> item = entry(QString("%1|%2|%3").arg(info.absoluteFilePath())
+                                       .arg(info.size()).arg(info.lastModified().toMSecsSinceEpoch()));
+    QMutexLocker lock(&item->mutex);
+    if (!item->loaded)
+    {
+        item->loaded = true;
+        QFile file(info.absoluteFilePath());
+        QByteArray contents;
+        QBuffer buffer(&contents);
+        buffer.open(QBuffer::WriteOnly);
+        if (file.open(QFile::ReadOnly) && Base64Encoder::encode(&file, &buffer))
+        {
+            store(item.data(), contents);
+            item->valid = true;
+        }
+    }
+    return item;
+}
+
+/**
+ * @brief AssetCache::prepare
+ * Checks that a file can be read, before anything is written for it.
+ * Files which are cached are read and encoded now, so that writing them can't fail part of the way through.
+ * @param filename the full path to the asset file
+ * @return false if the file can't be read
+ */
+bool AssetCache::prepare(const QString &filename)
+{
+    QFileInfo info(filename);
+    if (info.size() > STREAM_THRESHOLD)
+    {
+        QFile file(filename);
+        return file.open(QFile::ReadOnly);
+    }
+    QSharedPointer<Entry> item = load(info);
+    if (item.isNull()) return false;
+    QMutexLocker lock(&item->mutex);
+    return item->valid;
+}
+
+/**
+ * @brief AssetCache::base64
+ * @param filename the full path to the asset file
+ * @param encoded receives the base64 encoding of the file's contents
+ * @return false if the file can't be read
+ */
+bool AssetCache::base64(const QString &filename, QByteArray *encoded)
+{
+    QSharedPointer<Entry> item = load(QFileInfo(filename));
+    if (item.isNull()) return false;
+    QMutexLocker lock(&item->mutex);
+    if (!item->valid) return false;
+    *encoded = fetch(item.data());
+    return true;
+}
+
+/**
+ * @brief AssetCache::write
+ * Writes the base64 encoding of a file to the device.
+ * @param filename the full path to the asset file
+ * @param device
+ * @return false if the file couldn't be read or the device couldn't be written
+ */
+bool AssetCache::write(const QString &filename, QIODevice *device)
+{
+    QFileInfo info(filename);
+    if (info.size() > STREAM_THRESHOLD)
+    {
+        QFile file(filename);
+        return file.open(QFile::ReadOnly) && Base64Encoder::encode(&file, device);
+    }
+    QByteArray encoded;
+    return base64(filename, &encoded) && device->write(encoded) == encoded.size();
+}
+
+AssetCache::Prefetcher::Prefetcher(AssetCache *cache) :
+    p_cache(cache)
+{
+    p_pool.setMaxThreadCount(PREFETCH_THREADS);
+}
+
+AssetCache::Prefetcher::~Prefetcher()
+{
+    cancel();
+}
+
+/**
+ * @brief AssetCache::Prefetcher::prefetch
+ * Starts reading and encoding files which will be needed soon, without waiting for them.
+ * Any files from an earlier call to this prefetcher which haven't been started yet are dropped
+ * (they are read by the rendering threads instead, if they weren't prefetched in time),
+ * so only the latest files are ever waiting to be read.
+ * Files which are too large to be cached are ignored.
+ * @param filenames the full paths to the asset files
+ * @param resolve if set, gives the file which is actually needed for each file name
+ * (this is called on the prefetch threads, before the file is read).
+ */
+void AssetCache::Prefetcher::prefetch(const QStringList &filenames, const std::function<QString(const QString&)> &resolve)
+{
+    p_pool.clear();
+    AssetCache *cache = p_cache;
+    for (const QString &filename : filenames)
+    {
+        QtConcurrent::run(&p_pool, [cache, filename, resolve]() {
+            QFileInfo info(resolve ? resolve(filename) : filename);
+            if (info.size() <= STREAM_THRESHOLD) cache->load(info);
+        });
+    }
+}
+
+/**
+ * @brief AssetCache::Prefetcher::cancel
+ * Drops any files which are waiting to be prefetched by this prefetcher, and waits for those being read to finish.
+ */
+void AssetCache::Prefetcher::cancel()
+{
+    p_pool.clear();
+    p_pool.waitForDone();
+}
+
+/**
+ * @brief AssetCache::store
+ * Keeps the encoded asset in memory, or in the spill file once the memory budget has been used.
+ */
+void AssetCache::store(Entry *item, const QByteArray &encoded)
+{
+    {
+        QMutexLocker lock(&mutex);
+        if (p_memory_used + encoded.size() <= p_memory_budget)
+        {
+            p_memory_used += encoded.size();
+            item->data = encoded;
+            return;
+        }
+    }
+
+    QMutexLocker lock(&spill_mutex);
+    if (spill_file == nullptr)
+    {
+        spill_file = new QTemporaryFile;
+        if (!spill_file->open())
+            qWarning().noquote() << QObject::tr("Failed to create temporary file for assets: %1").arg(spill_file->errorString());
+    }
+    if (spill_file->isOpen() && spill_file->seek(spill_file->size()))
+    {
+        item->spill_offset = spill_file->pos();
+        item->spill_length = spill_file->write(encoded);
+        if (item->spill_length == encoded.size()) return;
+    }
+    // Couldn't spill, so it has to stay in memory
+    item->spill_offset = -1;
+    item->data = encoded;
+}
+
+/**
+ * @brief AssetCache::fetch
+ * @return the encoded asset, from wherever it is being kept.
+ */
+QByteArray AssetCache::fetch(const Entry *item)
+{
+    if (item->spill_offset < 0) return item->data;
+
+    QMutexLocker lock(&spill_mutex);
+    spill_file->seek(item->spill_offset);
+    return spill_file->read(item->spill_length);
+}
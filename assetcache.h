@@ -0,0 +1,108 @@
+#ifndef ASSETCACHE_H
+#define ASSETCACHE_H
+
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <functional>
+
+class QFileInfo;
+class QIODevice;
+class QTemporaryFile;
+
+/**
+ * @brief The AssetCache class
+ * The base64 encoding of each asset file used in an export, so that an asset which is used by many topics
+ * is only read and encoded once.
+ *
+ * Files are identified by their path, size and modification time.
+ * Once the encoded assets exceed the memory budget, any more are put into a temporary file instead.
+ * Files larger than STREAM_THRESHOLD aren't cached, but are encoded straight to the output each time they are used
+ * (so that memory use doesn't depend on the size of the assets).
+ * The cache is used by all the threads rendering topics; if several ask for the same file at once,
+ * only one of them reads it and the others wait for the result.
+ *
+ * The files needed by the next topics to be rendered can be given to a Prefetcher, so that they are read and encoded
+ * on separate threads while the current topics are being rendered and written.
+ */
+class AssetCache
+{
+public:
+    explicit AssetCache(qint64 memory_budget = DEFAULT_MEMORY_BUDGET);
+    ~AssetCache();
+
+    bool prepare(const QString &filename);
+    bool base64(const QString &filename, QByteArray *encoded);
+    bool write(const QString &filename, QIODevice *device);
+
+    /**
+     * @brief The Prefetcher class
+     * Reads files into the cache in the background, for one writer: each writer (e.g. each file of a sharded export)
+     * has its own prefetcher, so that it only replaces or cancels its own files.
+     */
+    class Prefetcher
+    {
+    public:
+        explicit Prefetcher(AssetCache *cache);
+        ~Prefetcher();
+        void prefetch(const QStringList &filenames, const std::function<QString(const QString&)> &resolve = nullptr);
+        void cancel();
+    private:
+        AssetCache *p_cache;
+        QThreadPool p_pool;
+        Q_DISABLE_COPY(Prefetcher)
+    };
+
+    static const qint64 DEFAULT_MEMORY_BUDGET = 256 * 1024 * 1024;
+    static const qint64 STREAM_THRESHOLD = 8 * 1024 * 1024;
+    // Number of files read at the same time by each Prefetcher
+    static const int PREFETCH_THREADS = 2;
+
+private:
+    struct Entry
+    {
+        QMutex mutex;
+        bool loaded{false};
+        bool valid{false};
+        QByteArray data;            // if held in memory
+        qint64 spill_offset{-1};    // otherwise, its position in the spill file
+        qint64 spill_length{0};
+    };
+    QSharedPointer<Entry> entry(const QString &key);
+    QSharedPointer<Entry> load(const QFileInfo &info);
+    void store(Entry *entry, const QByteArray &encoded);
+    QByteArray fetch(const Entry *entry);
+
+    QMutex mutex;
+    QHash<QString,QSharedPointer<Entry>> entries;
+    qint64 p_memory_budget;
+    qint64 p_memory_used{0};
+
+    QMutex spill_mutex;
+    QTemporaryFile *spill_file{nullptr};
+    Q_DISABLE_COPY(AssetCache)
+};
+
+#endif // ASSETCACHE_H
@@ -0,0 +1,304 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "base64encoder.h"
+
+#include <QIODevice>
+
+// The vectorised encoders are only built for x86, where they are chosen at run time
+// according to the capabilities of the CPU (everything else uses the scalar encoder).
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define BASE64_SIMD
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2  __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define BASE64_SIMD
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void encode_scalar(const uchar *in, int length, char *out)
+{
+    for (const uchar *end = in + length; in < end; in += 3, out += 4)
+    {
+        const uint group = (uint(in[0]) << 16) | (uint(in[1]) << 8) | in[2];
+        out[0] = alphabet[(group >> 18) & 0x3f];
+        out[1] = alphabet[(group >> 12) & 0x3f];
+        out[2] = alphabet[(group >>  6) & 0x3f];
+        out[3] = alphabet[ group        & 0x3f];
+    }
+}
+
+#ifdef BASE64_SIMD
+/*
+ * Each 16 byte lane takes 12 bytes of input and produces 16 characters:
+ *  - the input bytes are arranged so that each 32-bit word holds one group of three bytes;
+ *  - the four 6-bit values of each group are moved into separate bytes (using multiplies as variable shifts);
+ *  - each 6-bit value is turned into a character by adding an offset which depends on which range it is in.
+ * (See W. Muła and D. Lemire, "Faster Base64 Encoding and Decoding Using AVX2 Instructions", 2018.)
+ */
+
+TARGET_SSSE3 static inline __m128i encode_lane(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    const __m128i indices = _mm_or_si128(t1, t3);
+
+    __m128i offsets = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    offsets = _mm_or_si128(offsets, _mm_and_si128(less, _mm_set1_epi8(13)));
+    const __m128i shift_lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                            '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                            '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                            '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(_mm_shuffle_epi8(shift_lut, offsets), indices);
+}
+
+/**
+ * @brief encode_ssse3
+ * @return the number of input bytes which have been encoded (a multiple of 12)
+ */
+TARGET_SSSE3 static int encode_ssse3(const uchar *in, int length, char *out)
+{
+    int done = 0;
+    // Each load reads 16 bytes, of which 12 are used
+    for (; length - done >= 16; done += 12, out += 16)
+    {
+        const __m128i lane = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + done));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), encode_lane(lane));
+    }
+    return done;
+}
+
+TARGET_AVX2 static int encode_avx2(const uchar *in, int length, char *out)
+{
+    int done = 0;
+    // Each iteration reads 28 bytes, of which 24 are used
+    for (; length - done >= 28; done += 24, out += 32)
+    {
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + done));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + done + 12));
+        __m256i lanes = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+        lanes = _mm256_shuffle_epi8(lanes, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                                           10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        const __m256i t0 = _mm256_and_si256(lanes, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(lanes, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t1, t3);
+
+        __m256i offsets = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        offsets = _mm256_or_si256(offsets, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        const __m256i shift_lut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                                   '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                                   '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                                   '/' - 63, 'A', 0, 0,
+                                                   'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                                   '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                                   '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                                   '/' - 63, 'A', 0, 0);
+        const __m256i result = _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, offsets), indices);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), result);
+    }
+    // Finish with the narrower encoder
+    return done + encode_ssse3(in + done, length - done, out);
+}
+
+typedef int (*SimdEncoder)(const uchar *in, int length, char *out);
+
+/**
+ * @brief select_encoder
+ * @param implementation the encoder required (Automatic for the best one)
+ * @param supported if not null, set to false if the CPU doesn't support the required encoder
+ * @return the vectorised encoder, or nullptr if the scalar encoder is to be used.
+ */
+static SimdEncoder select_encoder(Base64Encoder::Implementation implementation = Base64Encoder::Automatic,
+                                  bool *supported = nullptr)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    const int max_leaf = info[0];
+    __cpuid(info, 1);
+    const bool ssse3   = (info[2] & (1 << 9)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx2 = false;
+    if (max_leaf >= 7 && osxsave && (_xgetbv(0) & 0x6) == 0x6)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    const bool ssse3 = __builtin_cpu_supports("ssse3");
+    const bool avx2  = __builtin_cpu_supports("avx2");
+#endif
+    if (supported)
+        *supported = (implementation == Base64Encoder::AVX2) ? avx2 :
+                     (implementation == Base64Encoder::SSSE3) ? ssse3 : true;
+    switch (implementation)
+    {
+    case Base64Encoder::Scalar: return nullptr;
+    case Base64Encoder::SSSE3:  return ssse3 ? encode_ssse3 : nullptr;
+    case Base64Encoder::AVX2:   return avx2 ? encode_avx2 : nullptr;
+    case Base64Encoder::Automatic: break;
+    }
+    if (avx2)  return encode_avx2;
+    if (ssse3) return encode_ssse3;
+    return nullptr;
+}
+
+static SimdEncoder simd_encoder = select_encoder();
+#endif
+
+/**
+ * @brief Base64Encoder::setImplementation
+ * Chooses which encoder is used (this must not be called while anything is being encoded).
+ * @param implementation
+ * @return false if the implementation isn't available on this CPU (in which case the scalar encoder is used).
+ */
+bool Base64Encoder::setImplementation(Implementation implementation)
+{
+#ifdef BASE64_SIMD
+    bool supported;
+    simd_encoder = select_encoder(implementation, &supported);
+    return supported;
+#else
+    return implementation == Automatic || implementation == Scalar;
+#endif
+}
+
+/**
+ * @brief encode_groups
+ * @param in the data to encode
+ * @param length the number of bytes (must be a multiple of 3)
+ * @param out receives length/3*4 characters
+ */
+static void encode_groups(const uchar *in, int length, char *out)
+{
+#ifdef BASE64_SIMD
+    if (simd_encoder)
+    {
+        // The vector encoder leaves a few groups at the end (it never reads beyond the end of the input)
+        const int done = simd_encoder(in, length, out);
+        in  += done;
+        out += done / 3 * 4;
+        length -= done;
+    }
+#endif
+    encode_scalar(in, length, out);
+}
+
+/**
+ * @brief Base64Encoder::encode
+ * @param data the next piece of the data
+ * @return the encoding of all the complete groups of three bytes received so far, which haven't already been returned
+ */
+QByteArray Base64Encoder::encode(const QByteArray &data)
+{
+    const uchar *in = reinterpret_cast<const uchar*>(data.constData());
+    int length = data.size();
+
+    QByteArray result;
+    result.resize((p_carry_size + length) / 3 * 4);
+    char *out = result.data();
+
+    // Complete the group carried from the previous piece
+    if (p_carry_size > 0)
+    {
+        if (p_carry_size + length < 3)
+        {
+            while (length-- > 0) p_carry[p_carry_size++] = *in++;
+            return result;
+        }
+        uchar group[3];
+        int i = 0;
+        for (; i < p_carry_size; i++) group[i] = p_carry[i];
+        for (; i < 3; i++, length--) group[i] = *in++;
+        encode_groups(group, 3, out);
+        out += 4;
+        p_carry_size = 0;
+    }
+
+    const int whole = length / 3 * 3;
+    encode_groups(in, whole, out);
+
+    // Keep the remainder for the next piece
+    for (int i = whole; i < length; i++)
+        p_carry[p_carry_size++] = in[i];
+    return result;
+}
+
+/**
+ * @brief Base64Encoder::finish
+ * @return the encoding of the last incomplete group (with padding), if any.
+ */
+QByteArray Base64Encoder::finish()
+{
+    QByteArray result;
+    if (p_carry_size == 1)
+    {
+        const uint group = uint(p_carry[0]) << 16;
+        result.append(alphabet[(group >> 18) & 0x3f]);
+        result.append(alphabet[(group >> 12) & 0x3f]);
+        result.append("==");
+    }
+    else if (p_carry_size == 2)
+    {
+        const uint group = (uint(p_carry[0]) << 16) | (uint(p_carry[1]) << 8);
+        result.append(alphabet[(group >> 18) & 0x3f]);
+        result.append(alphabet[(group >> 12) & 0x3f]);
+        result.append(alphabet[(group >>  6) & 0x3f]);
+        result.append('=');
+    }
+    p_carry_size = 0;
+    return result;
+}
+
+/**
+ * @brief Base64Encoder::encode
+ * Reads the source in chunks of CHUNK_SIZE bytes, writing the encoding of each chunk to the destination
+ * before reading the next one.
+ * @param source
+ * @param destination
+ * @return false if the source couldn't be read or the destination couldn't be written
+ */
+bool Base64Encoder::encode(QIODevice *source, QIODevice *destination)
+{
+    Base64Encoder encoder;
+    QByteArray chunk;
+    while (!source->atEnd())
+    {
+        chunk = source->read(CHUNK_SIZE);
+        if (chunk.isEmpty()) return false;
+        const QByteArray encoded = encoder.encode(chunk);
+        if (destination->write(encoded) != encoded.size()) return false;
+    }
+    const QByteArray encoded = encoder.finish();
+    return destination->write(encoded) == encoded.size();
+}
@@ -0,0 +1,54 @@
+#ifndef BASE64ENCODER_H
+#define BASE64ENCODER_H
+
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QByteArray>
+
+class QIODevice;
+
+/**
+ * @brief The Base64Encoder class
+ * Encodes data as base64 (the same as QByteArray::toBase64) one piece at a time,
+ * so that large files can be encoded without holding the whole file, or its encoding, in memory.
+ *
+ * Any bytes at the end of a piece which don't make a complete group of three are carried over to the next piece.
+ */
+class Base64Encoder
+{
+public:
+    QByteArray encode(const QByteArray &data);
+    QByteArray finish();
+
+    static bool encode(QIODevice *source, QIODevice *destination);
+
+    // The encoder is normally chosen according to the CPU; the others are only selected for testing
+    // (see benchmarks/base64), before anything is encoded.
+    enum Implementation { Automatic, Scalar, SSSE3, AVX2 };
+    static bool setImplementation(Implementation implementation);
+
+    // Amount read from the source at a time (a multiple of 3, so that nothing normally needs to be carried)
+    static const int CHUNK_SIZE = 3 * 256 * 1024;
+
+private:
+    uchar p_carry[2];
+    int p_carry_size{0};
+};
+
+#endif // BASE64ENCODER_H
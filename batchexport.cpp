@@ -0,0 +1,204 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "batchexport.h"
+
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include "batchrunner.h"
+#include "datamodelloader.h"
+#include "derivedcolumnsproxymodel.h"
+#include "exportvalidator.h"
+#include "incrementalstate.h"
+#include "projectfile.h"
+#include "rw_topic.h"
+
+BatchExport::BatchExport(QObject *parent) :
+    QObject(parent),
+    derived_columns(new DerivedColumnsProxyModel(this))
+{
+}
+
+BatchExport::~BatchExport()
+{
+    qDeleteAll(all_topics);
+}
+
+/**
+ * @brief BatchExport::loadProject
+ * Reads the project file (see ProjectFile), along with the data and structure files which it names.
+ * @param project_file
+ * @param data_override if not empty, the data file to be used instead of the one named in the project
+ * @param shared if not null, then data and structure files are obtained from here rather than being read directly
+ * (the data model is then shared, and must not be modified).
+ * @return true if the project, data and structure were all loaded
+ */
+bool BatchExport::loadProject(const QString &project_file, const QString &data_override, SharedInputs *shared)
+{
+    ExportLog::Scope log_scope(&p_log);
+
+    ProjectFile project;
+    if (!project.open(project_file))
+    {
+        qCritical().noquote() << project.errorString();
+        return false;
+    }
+    QCryptographicHash mapping(QCryptographicHash::Sha1);
+    mapping.addData(project.contents());
+
+    // Relative paths in the project are relative to the project file
+    QDir project_dir = QFileInfo(project_file).absoluteDir();
+    QString datafile = project.data_file;
+    if (!data_override.isEmpty()) datafile = QDir::current().absoluteFilePath(data_override);
+    datafile = project_dir.absoluteFilePath(datafile);
+    const QString structurefile = project_dir.absoluteFilePath(project.structure_file);
+
+    data_model = shared ? shared->dataModel(datafile, project.worksheet, project.array_name)
+                        : loadDataModel(datafile, project.worksheet, project.array_name, this);
+    if (data_model == nullptr)
+    {
+        qCritical().noquote() << tr("Failed to load data from %1").arg(datafile);
+        return false;
+    }
+    QByteArray source_key = dataSourceKey(shared ? shared->fileHash(datafile) : dataFileHash(datafile),
+                                          project.worksheet, project.array_name);
+
+    // Images and lookup() files are found relative to the data directory.
+    // (The current directory isn't changed, since it is shared by all the threads.)
+    rw_structure.data_directory = QFileInfo(datafile).absolutePath();
+    derived_columns->setDataDirectory(rw_structure.data_directory);
+    derived_columns->setSourceModel(data_model);
+    if (shared) rw_structure.url_assets = &shared->urlAssets();
+
+    // Each project gets its own copy of the structure, since the export modifies it.
+    QByteArray structure_contents;
+    if (shared)
+        structure_contents = shared->fileContents(structurefile);
+    else
+    {
+        QFile structure(structurefile);
+        if (structure.open(QFile::ReadOnly)) structure_contents = structure.readAll();
+    }
+    if (structure_contents.isEmpty())
+    {
+        qCritical().noquote() << tr("Failed to load structure from %1").arg(structurefile);
+        return false;
+    }
+    mapping.addData(structure_contents);
+    mapping_hash = mapping.result();
+    QBuffer structure(&structure_contents);
+    structure.open(QBuffer::ReadOnly);
+    rw_structure.loadFile(&structure);
+
+    if (!project.readContents(&rw_structure, &all_topics, derived_columns, source_key))
+    {
+        qCritical().noquote() << project.errorString();
+        return false;
+    }
+    if (project.has_force_format3) rw_structure.forceFormatVersion(project.force_format3 ? 3 : 0);
+    return true;
+}
+
+/**
+ * @brief BatchExport::writeExport
+ * Generates the RWEXPORT file from the loaded project (on the calling thread).
+ * @param output_file
+ * @param incremental if true, then only the topics which have changed since the previous incremental export
+ * to the same file are written (the previous state is stored alongside the output file, see IncrementalState).
+ * @param limits if any limit is set, then the export is split into several numbered files
+ * (see RealmWorksStructure::writeShardedExport).
+ * @param validate if true, then all the rows are checked first (see ExportValidator), and nothing is written
+ * if any problems are found.
+ * @return true if the file was written completely
+ */
+bool BatchExport::writeExport(const QString &output_file, bool incremental, const RealmWorksStructure::ShardLimits &limits,
+                              bool validate)
+{
+    ExportLog::Scope log_scope(&p_log);
+
+    if (validate)
+    {
+        const QStringList findings = ExportValidator(&rw_structure, derived_columns).validate(all_topics.values(), /*stable_topic_ids*/ incremental);
+        for (auto &finding : findings)
+            qWarning().noquote() << finding;
+        if (!findings.isEmpty())
+        {
+            qCritical().noquote() << tr("%1: not exported, because %n problem(s) were found", "", findings.size())
+                                     .arg(QFileInfo(output_file).fileName());
+            return false;
+        }
+    }
+
+    IncrementalState state;
+    const QString state_file = IncrementalState::stateFileName(output_file);
+    if (incremental)
+    {
+        state.load(state_file);
+        state.setMappingHash(mapping_hash);
+    }
+
+    bool result;
+    if (limits.max_topics > 0 || limits.max_bytes > 0)
+    {
+        // Remove the files from a previous run, which might have been split differently
+        QFileInfo info(output_file);
+        QDir dir = info.absoluteDir();
+        for (auto &old_file : dir.entryList(QStringList(info.completeBaseName() + "_[0-9][0-9][0-9]." + info.suffix()), QDir::Files))
+        {
+            if (!dir.remove(old_file))
+            {
+                qCritical().noquote() << tr("Failed to remove old file") << dir.absoluteFilePath(old_file);
+                return false;
+            }
+        }
+        result = rw_structure.writeShardedExport(output_file, all_topics.values(), derived_columns, limits,
+                                                 incremental ? &state : nullptr);
+    }
+    else
+    {
+        QFile file(output_file);
+        if (file.exists() && !file.remove())
+        {
+            qCritical().noquote() << tr("Failed to remove old file") << file.fileName();
+            return false;
+        }
+        if (!file.open(QFile::WriteOnly))
+        {
+            qCritical().noquote() << tr("Failed to create file") << file.fileName();
+            return false;
+        }
+        result = rw_structure.writeExportFile(&file, all_topics.values(), derived_columns, incremental ? &state : nullptr);
+        file.close();
+        if (!result) file.remove();
+    }
+    if (!result) return false;
+    // The state is only updated once the delta has been written successfully,
+    // otherwise the changes in this run would be missed by the next one.
+    if (incremental)
+    {
+        if (!state.save(state_file)) return false;
+        qInfo().noquote() << tr("%1: %2 new or changed topics").arg(QFileInfo(output_file).fileName()).arg(state.changedCount());
+    }
+    return true;
+}
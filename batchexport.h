@@ -0,0 +1,62 @@
+#ifndef BATCHEXPORT_H
+#define BATCHEXPORT_H
+
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QObject>
+#include <QMap>
+#include "realmworksstructure.h"
+#include "exportlog.h"
+
+class QAbstractItemModel;
+class DerivedColumnsProxyModel;
+class RWTopic;
+class SharedInputs;
+
+/**
+ * @brief The BatchExport class
+ * Loads a project file (along with its data and structure files) without creating any widgets,
+ * and then generates the RWEXPORT file from it.
+ * All the state for the export belongs to this object, so several can be used at once on different threads;
+ * any warnings are collected in log().
+ */
+class BatchExport : public QObject
+{
+    Q_OBJECT
+public:
+    explicit BatchExport(QObject *parent = nullptr);
+    ~BatchExport() override;
+
+    bool loadProject(const QString &project_file, const QString &data_override = QString(),
+                     SharedInputs *shared = nullptr);
+    bool writeExport(const QString &output_file, bool incremental = false,
+                     const RealmWorksStructure::ShardLimits &limits = RealmWorksStructure::ShardLimits(),
+                     bool validate = false);
+    const ExportLog &log() const { return p_log; }
+
+private:
+    RealmWorksStructure rw_structure;
+    ExportLog p_log;
+    QAbstractItemModel *data_model{nullptr};
+    DerivedColumnsProxyModel *derived_columns{nullptr};
+    QMap<QString,RWTopic*> all_topics;
+    QByteArray mapping_hash;    // of the project and structure files, for incremental exports
+};
+
+#endif // BATCHEXPORT_H
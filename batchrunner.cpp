@@ -0,0 +1,200 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "batchrunner.h"
+
+#include <QAbstractItemModel>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include "batchexport.h"
+#include "datamodelloader.h"
+
+SharedInputs::~SharedInputs()
+{
+    for (auto entry: entries)
+        delete entry->model;
+    qDeleteAll(entries);
+}
+
+SharedInputs::Entry *SharedInputs::entry(const QString &key)
+{
+    QMutexLocker lock(&mutex);
+    Entry *&result = entries[key];
+    if (result == nullptr) result = new Entry;
+    return result;
+}
+
+/**
+ * @brief SharedInputs::dataModel
+ * @return the model for the given data file, worksheet and array (or nullptr if it can't be read)
+ */
+QAbstractItemModel *SharedInputs::dataModel(const QString &filename, const QString &worksheet, const QString &array_name)
+{
+    Entry *item = entry("model:" + QFileInfo(filename).absoluteFilePath() + '\n' + worksheet + '\n' + array_name);
+    QMutexLocker lock(&item->mutex);
+    if (!item->loaded)
+    {
+        item->model = loadDataModel(filename, worksheet, array_name);
+        item->loaded = true;
+    }
+    return item->model;
+}
+
+QByteArray SharedInputs::fileHash(const QString &filename)
+{
+    Entry *item = entry("hash:" + QFileInfo(filename).absoluteFilePath());
+    QMutexLocker lock(&item->mutex);
+    if (!item->loaded)
+    {
+        item->bytes = dataFileHash(filename);
+        item->loaded = true;
+    }
+    return item->bytes;
+}
+
+QByteArray SharedInputs::fileContents(const QString &filename)
+{
+    Entry *item = entry("file:" + QFileInfo(filename).absoluteFilePath());
+    QMutexLocker lock(&item->mutex);
+    if (!item->loaded)
+    {
+        QFile file(filename);
+        if (file.open(QFile::ReadOnly)) item->bytes = file.readAll();
+        item->loaded = true;
+    }
+    return item->bytes;
+}
+
+
+namespace {
+
+struct ProjectJob
+{
+    QString project;
+    QString output;
+    QString data;
+    bool incremental{false};
+    RealmWorksStructure::ShardLimits limits;
+    bool validate{false};
+};
+
+struct ProjectResult
+{
+    bool ok{false};
+    qint64 msecs{0};
+    QStringList messages;
+};
+
+ProjectResult run_job(const ProjectJob &job, SharedInputs *shared)
+{
+    ProjectResult result;
+    QElapsedTimer timer;
+    timer.start();
+    {
+        BatchExport exporter;
+        result.ok = exporter.loadProject(job.project, job.data, shared) &&
+                exporter.writeExport(job.output, job.incremental, job.limits, job.validate);
+        result.messages = exporter.log().messages();
+    }
+    result.msecs = timer.elapsed();
+    return result;
+}
+
+}
+
+/**
+ * @brief BatchRunner::run
+ * @param manifest the file listing the projects to be exported
+ * @param max_jobs the maximum number of projects to export at the same time
+ * @param incremental if true, then each export only contains the topics which have changed since its previous run
+ * @param limits if set, then each export is split into several files
+ * @param validate if true, then each project is checked before it is exported, and isn't exported if problems are found
+ * @return the exit code for the application: 0 if all the projects were exported without any issues being reported.
+ */
+int BatchRunner::run(const QString &manifest, int max_jobs, bool incremental, const RealmWorksStructure::ShardLimits &limits,
+                     bool validate)
+{
+    QFile file(manifest);
+    if (!file.open(QFile::ReadOnly|QFile::Text))
+    {
+        qCritical().noquote() << QObject::tr("Failed to open manifest file") << manifest;
+        return 2;
+    }
+    QDir base = QFileInfo(manifest).absoluteDir();
+
+    QList<ProjectJob> jobs;
+    QTextStream stream(&file);
+    while (!stream.atEnd())
+    {
+        QString line = stream.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#')) continue;
+        QStringList fields = line.split('\t');
+        ProjectJob job;
+        job.project = base.absoluteFilePath(fields.at(0).trimmed());
+        if (fields.size() > 1 && !fields.at(1).trimmed().isEmpty())
+            job.output = base.absoluteFilePath(fields.at(1).trimmed());
+        else
+        {
+            QFileInfo info(job.project);
+            job.output = info.absoluteDir().absoluteFilePath(info.completeBaseName() + ".rwexport");
+        }
+        if (fields.size() > 2 && !fields.at(2).trimmed().isEmpty())
+            job.data = base.absoluteFilePath(fields.at(2).trimmed());
+        job.incremental = incremental;
+        job.limits = limits;
+        job.validate = validate;
+        jobs.append(job);
+    }
+
+    // The projects run on their own pool, leaving the global pool for rendering the topics of each export.
+    SharedInputs shared;
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, max_jobs));
+
+    QElapsedTimer total_timer;
+    total_timer.start();
+    QList<QFuture<ProjectResult>> futures;
+    for (auto &job : jobs)
+        futures.append(QtConcurrent::run(&pool, run_job, job, &shared));
+
+    QTextStream out(stdout);
+    int failures = 0;
+    for (int i = 0; i < jobs.size(); i++)
+    {
+        const ProjectResult result = futures[i].result();
+        bool clean = result.ok && result.messages.isEmpty();
+        if (!clean) failures++;
+        out << (result.ok ? (clean ? "OK     " : "WARN   ") : "FAILED ")
+            << QString("%1 s  ").arg(result.msecs / 1000.0, 8, 'f', 3)
+            << QDir::toNativeSeparators(jobs.at(i).project) << '\n';
+        for (auto &message : result.messages)
+            out << "        " << message << '\n';
+    }
+    out << QObject::tr("%1 projects, %2 with issues, %3 s in total")
+           .arg(jobs.size()).arg(failures).arg(total_timer.elapsed() / 1000.0, 0, 'f', 3) << '\n';
+    out.flush();
+
+    return (failures > 0) ? 1 : 0;
+}
@@ -0,0 +1,84 @@
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QByteArray>
+#include "realmworksstructure.h"
+#include "urlassetfetcher.h"
+
+class QAbstractItemModel;
+
+/**
+ * @brief The SharedInputs class
+ * Data and structure files which are used by several projects are only read once.
+ * Each file is read by the first thread to ask for it; other threads asking for the same file wait for it.
+ * The data models are shared read-only between all the projects which use them.
+ * URL assets are fetched by a single UrlAssetFetcher, so that only one disk cache is used by the process.
+ */
+class SharedInputs
+{
+public:
+    SharedInputs() = default;
+    ~SharedInputs();
+
+    QAbstractItemModel *dataModel(const QString &filename, const QString &worksheet, const QString &array_name);
+    QByteArray fileHash(const QString &filename);
+    QByteArray fileContents(const QString &filename);
+    UrlAssetFetcher &urlAssets() { return url_assets; }
+
+private:
+    struct Entry
+    {
+        QMutex mutex;
+        bool loaded{false};
+        QAbstractItemModel *model{nullptr};
+        QByteArray bytes;
+    };
+    Entry *entry(const QString &key);
+    QMutex mutex;
+    QHash<QString,Entry*> entries;
+    UrlAssetFetcher url_assets;
+    Q_DISABLE_COPY(SharedInputs)
+};
+
+/**
+ * @brief The BatchRunner class
+ * Exports all the projects listed in a manifest file, several at a time.
+ *
+ * Each line of the manifest contains the following fields, separated by TAB characters
+ * (only the first is required; relative names are relative to the manifest file):
+ *
+ *     project.csv2rw    [output.rwexport]    [data override]
+ *
+ * If no output is given, then it is written next to the project with the extension ".rwexport".
+ * Blank lines and lines starting with '#' are ignored.
+ */
+class BatchRunner
+{
+public:
+    int run(const QString &manifest, int max_jobs, bool incremental = false,
+            const RealmWorksStructure::ShardLimits &limits = RealmWorksStructure::ShardLimits(),
+            bool validate = false);
+};
+
+#endif // BATCHRUNNER_H
@@ -0,0 +1,20 @@
+# Benchmark and equivalence check for Base64Encoder:
+#
+#     base64bench <directory of image, PDF and audio files> [repeats]
+#
+# Every available encoder (scalar, SSSE3, AVX2) is compared byte for byte with QByteArray::toBase64,
+# and timed against it, on each file in the directory and on generated data of awkward lengths.
+
+QT       = core
+CONFIG  += console c++11
+CONFIG  -= app_bundle
+
+TARGET   = base64bench
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += main.cpp \
+    ../../base64encoder.cpp
+
+HEADERS += ../../base64encoder.h
@@ -0,0 +1,205 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QTextStream>
+
+#include "base64encoder.h"
+
+static QTextStream out(stdout);
+// Receives the size of each timed encoding, so that the encoding can't be optimised away
+static volatile int sink;
+
+struct Encoder
+{
+    const char *name;
+    Base64Encoder::Implementation implementation;
+};
+
+static const Encoder encoders[] = {
+    { "scalar", Base64Encoder::Scalar },
+    { "SSSE3",  Base64Encoder::SSSE3 },
+    { "AVX2",   Base64Encoder::AVX2 },
+};
+
+// Encodes the data in one piece
+static QByteArray encode_whole(const QByteArray &data)
+{
+    Base64Encoder encoder;
+    return encoder.encode(data) + encoder.finish();
+}
+
+// Encodes the data in pieces of the given size (so that incomplete groups are carried between pieces)
+static QByteArray encode_pieces(const QByteArray &data, int piece)
+{
+    Base64Encoder encoder;
+    QByteArray result;
+    for (int pos = 0; pos < data.size(); pos += piece)
+        result += encoder.encode(data.mid(pos, piece));
+    return result + encoder.finish();
+}
+
+// Encodes the data from one device to another, as is done for large assets
+static QByteArray encode_stream(const QByteArray &data)
+{
+    QByteArray source_data(data);
+    QBuffer source(&source_data);
+    source.open(QBuffer::ReadOnly);
+    QByteArray result;
+    QBuffer destination(&result);
+    destination.open(QBuffer::WriteOnly);
+    if (!Base64Encoder::encode(&source, &destination)) return QByteArray("<failed>");
+    return result;
+}
+
+/**
+ * @brief compare
+ * @return true if actual is identical to expected; otherwise the first difference is reported.
+ */
+static bool compare(const QString &what, const QByteArray &actual, const QByteArray &expected)
+{
+    if (actual == expected) return true;
+    int pos = 0;
+    while (pos < actual.size() && pos < expected.size() && actual.at(pos) == expected.at(pos)) pos++;
+    out << "MISMATCH " << what << ": " << actual.size() << " characters instead of " << expected.size()
+        << ", first difference at " << pos << '\n';
+    return false;
+}
+
+/**
+ * @brief check_data
+ * Encodes the data in each of the ways it is encoded by the application.
+ * @return the number of encodings which differ from QByteArray::toBase64
+ */
+static int check_data(const QString &what, const QByteArray &data)
+{
+    const QByteArray expected = data.toBase64();
+    int failures = 0;
+    if (!compare(what + " (whole)",  encode_whole(data), expected)) failures++;
+    if (!compare(what + " (stream)", encode_stream(data), expected)) failures++;
+    for (int piece : { 1, 7, 13, 29, 4099 })
+    {
+        // (Tiny pieces take too long for large files)
+        if (piece < 4099 && data.size() > 4 * 1024 * 1024) continue;
+        if (piece < data.size() && !compare(QString("%1 (pieces of %2)").arg(what).arg(piece), encode_pieces(data, piece), expected))
+            failures++;
+    }
+    return failures;
+}
+
+/**
+ * @brief generated_data
+ * @return data of every length up to 300 bytes, and some larger lengths, none of which need to be
+ * multiples of the 12, 24 or 28 bytes handled by each step of the vectorised encoders.
+ */
+static QList<QByteArray> generated_data()
+{
+    QList<int> lengths;
+    for (int length = 0; length <= 300; length++) lengths.append(length);
+    for (int length : { 1021, 4097, 65537, Base64Encoder::CHUNK_SIZE - 1, Base64Encoder::CHUNK_SIZE + 1,
+                        Base64Encoder::CHUNK_SIZE * 2 + 13, 1000003 })
+        lengths.append(length);
+
+    QRandomGenerator random(20200101);
+    QList<QByteArray> result;
+    for (int length : lengths)
+    {
+        QByteArray data(length, Qt::Uninitialized);
+        for (int i = 0; i < length; i++) data[i] = char(random.bounded(256));
+        result.append(data);
+    }
+    // Values at the edges of each range of the alphabet
+    result.append(QByteArray(301, '\xff'));
+    result.append(QByteArray(301, '\0'));
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    const QStringList args = app.arguments();
+    if (args.size() < 2)
+    {
+        out << "Usage: base64bench <directory of image, PDF and audio files> [repeats]\n";
+        return 2;
+    }
+    const int repeats = (args.size() > 2) ? qMax(1, args.at(2).toInt()) : 5;
+
+    // The corpus
+    QList<QByteArray> files;
+    QStringList names;
+    qint64 total_bytes = 0;
+    const QDir corpus(args.at(1));
+    QDirIterator it(corpus.absolutePath(), QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext())
+    {
+        QFile file(it.next());
+        if (!file.open(QFile::ReadOnly)) continue;
+        files.append(file.readAll());
+        names.append(corpus.relativeFilePath(it.filePath()));
+        total_bytes += files.last().size();
+    }
+    if (files.isEmpty())
+    {
+        out << "No files found in " << args.at(1) << '\n';
+        return 2;
+    }
+    out << files.size() << " files, " << total_bytes << " bytes, " << repeats << " repeats\n";
+
+    const QList<QByteArray> generated = generated_data();
+    int failures = 0;
+
+    // QByteArray::toBase64 is the reference, both for the output and the time
+    QElapsedTimer timer;
+    timer.start();
+    for (int repeat = 0; repeat < repeats; repeat++)
+        for (const QByteArray &data : files) sink = data.toBase64().size();
+    const qint64 reference_ns = qMax(Q_INT64_C(1), timer.nsecsElapsed());
+    const double mbytes = double(total_bytes) * repeats / (1024 * 1024);
+    out << QString("%1 %2 MB/s\n").arg("toBase64", -10).arg(mbytes * 1e9 / reference_ns, 9, 'f', 1);
+
+    for (const Encoder &encoder : encoders)
+    {
+        if (!Base64Encoder::setImplementation(encoder.implementation))
+        {
+            out << QString("%1 not supported by this CPU\n").arg(encoder.name, -10);
+            continue;
+        }
+
+        for (const QByteArray &data : generated)
+            failures += check_data(QString("%1, %2 generated bytes").arg(encoder.name).arg(data.size()), data);
+        for (int i = 0; i < files.size(); i++)
+            failures += check_data(QString("%1, %2").arg(encoder.name, names.at(i)), files.at(i));
+
+        timer.restart();
+        for (int repeat = 0; repeat < repeats; repeat++)
+            for (const QByteArray &data : files) sink = encode_whole(data).size();
+        const qint64 ns = qMax(Q_INT64_C(1), timer.nsecsElapsed());
+        out << QString("%1 %2 MB/s  (%3 x toBase64)\n").arg(encoder.name, -10)
+               .arg(mbytes * 1e9 / ns, 9, 'f', 1).arg(double(reference_ns) / ns, 0, 'f', 2);
+    }
+    Base64Encoder::setImplementation(Base64Encoder::Automatic);
+
+    out << (failures ? QString("%1 MISMATCHES\n").arg(failures) : QString("All encodings identical to toBase64\n"));
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,23 @@
+# Regression check and benchmark for the links put into snippet text (see RWContentsItem::xmlSpan):
+#
+#     linkbench [directory of text files] [repeats]
+#
+# appendLinkedText is compared with the previous QString::replace(url_regexp, ...) on sample text
+# containing URLs, e-mail addresses, scheme-like words (e.g. "Note:12"), "www." and entities,
+# on random text built from the same pieces, and on each line of the text files in the directory.
+# It also checks that mayContainUrl is never false for text which contains a URL.
+
+QT       = core
+CONFIG  += console c++11
+CONFIG  -= app_bundle
+
+TARGET   = linkbench
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += main.cpp \
+    ../../urllinks.cpp
+
+HEADERS += ../../urllinks.h \
+    ../../regexp.h
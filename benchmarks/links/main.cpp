@@ -0,0 +1,210 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QTextStream>
+
+#include "urllinks.h"
+#include "regexp.h"
+
+static QTextStream out(stdout);
+// Receives the size of each timed result, so that the work can't be optimised away
+static volatile int sink;
+
+// The styles of span which can follow a link
+static const QString span_starts[] = {
+    "<span class=\"RWSnippet\">",
+    "<span class=\"RWSnippet\" style=\"font-weight:bold\">",
+};
+
+static const char *const samples[] = {
+    "",
+    " ",
+    "Plain text without any links.",
+    "See http://www.example.com for details.",
+    "See https://example.com/path/to/page.html?a=1&b=2#section, then go back.",
+    "ftp://files.example.org/pub/file.tar.gz",
+    "Mail me at someone@example.com or someone.else@example.co.uk.",
+    "mailto:someone@example.com",
+    "user:password@host.example.com/private",
+    "Note:12",
+    "Note:12 and Page:3 and 12:30 and ratio 3:4",
+    "TODO: finish this",
+    "www.example.com",
+    "wwww.example.com and www.",
+    "Visit www.example.com/index.html?x=1, or (www.example.org).",
+    "<http://example.com/>",
+    "\"http://example.com/quoted\"",
+    "Fish & Chips <b>bold</b> \"quoted\" 'single'",
+    "a&b@example.com",
+    "http://example.com/a&b=c&amp;d",
+    "&lt;http://example.com&gt;",
+    "http://example.com,http://example.org;www.example.net",
+    "http://a.b http://c.d\thttp://e.f\nhttp://g.h\r\nhttp://i.j",
+    "Caf\xc3\xa9 http://example.com/caf\xc3\xa9 na\xc3\xafve@example.com",
+    "Non\xc2\xa0" "breaking http://example.com\xc2\xa0space",
+    "http://",
+    "https:",
+    "@",
+    "@@ :: ..",
+    "x@y",
+    "http://example.com/path\\with\\backslashes!",
+    "http://example.com/#!/fragment/path",
+    "C:\\Program Files\\RealmWorks",
+    "<p>Already <a href=\"http://example.com\">marked up</a></p>",
+};
+
+// Pieces from which random samples are built
+static const char *const pieces[] = {
+    "http://", "https://", "ftp://", "mailto:", "www.", "wwww", "www", "Note:12", "12:30", ":", "::",
+    "@", "user@", "example", ".com", ".", "/", "?", "#", "=", "&", ";", "%20", "-", "+", "~", "!", "\\",
+    "<", ">", "\"", "'", "&amp;", "&lt;", "(", ")", ",", "a", "Z", "9", "_", "\xc3\xa9",
+    " ", " ", " ", "\t", "\n", "\r\n", "\xc2\xa0",
+};
+
+/**
+ * @brief old_span
+ * @return the span for the text as it was generated by QString::replace before appendLinkedText.
+ */
+static QString old_span(const QString &text, const QString &start_rwsnippet)
+{
+    QString buffer = text;
+    const QString url_replacement("<a class=\"RWLink\" style=\"color:#000000;text-decoration:none\" href=\"\\1\" title=\"\\1\"><span class=\"RWLink\">\\1</span></a></span>" + start_rwsnippet);
+    return start_rwsnippet + buffer.replace(url_regexp, url_replacement) + "</span>";
+}
+
+static QString new_span(const QString &text, const QString &start_rwsnippet)
+{
+    QString result;
+    result.reserve(start_rwsnippet.size() + text.size() + 7);
+    result.append(start_rwsnippet);
+    appendLinkedText(result, text, start_rwsnippet);
+    result.append("</span>");
+    return result;
+}
+
+/**
+ * @brief check_text
+ * Compares the old and new output for the text, both as it is and HTML-escaped (as done by xmlSpan).
+ * @return the number of differences
+ */
+static int check_text(const QString &what, const QString &text)
+{
+    int failures = 0;
+    const bool may_contain_url = mayContainUrl(QStringRef(&text));
+    for (const QString &input : { text, text.toHtmlEscaped() })
+        for (const QString &start_rwsnippet : span_starts)
+        {
+            const QString expected = old_span(input, start_rwsnippet);
+            const QString actual = new_span(input, start_rwsnippet);
+            if (actual != expected)
+            {
+                out << "MISMATCH " << what << ": " << input << '\n'
+                    << "  expected: " << expected << '\n'
+                    << "  actual:   " << actual << '\n';
+                failures++;
+            }
+            // Text without a URL is written without going through xmlSpan (see writeRichText)
+            if (!may_contain_url && expected != start_rwsnippet + input + "</span>")
+            {
+                out << "MISSED URL " << what << ": " << input << '\n';
+                failures++;
+            }
+        }
+    return failures;
+}
+
+static QStringList random_samples(int count)
+{
+    const int num_pieces = int(sizeof(pieces) / sizeof(pieces[0]));
+    QRandomGenerator random(20200101);
+    QStringList result;
+    for (int i = 0; i < count; i++)
+    {
+        QString text;
+        const int length = random.bounded(1, 40);
+        for (int piece = 0; piece < length; piece++)
+            text += QString::fromUtf8(pieces[random.bounded(num_pieces)]);
+        result.append(text);
+    }
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    const QStringList args = app.arguments();
+    const int repeats = (args.size() > 2) ? qMax(1, args.at(2).toInt()) : 5;
+
+    QStringList corpus;
+    for (const char *sample : samples)
+        corpus.append(QString::fromUtf8(sample));
+    const int num_samples = corpus.size();
+    corpus.append(random_samples(20000));
+
+    // Each line (and each paragraph) of the text files
+    int num_files = 0;
+    if (args.size() > 1)
+    {
+        const QDir directory(args.at(1));
+        QDirIterator it(directory.absolutePath(), QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext())
+        {
+            QFile file(it.next());
+            if (!file.open(QFile::ReadOnly | QFile::Text)) continue;
+            const QString contents = QString::fromUtf8(file.readAll());
+            corpus.append(contents.split('\n'));
+            corpus.append(contents.split("\n\n"));
+            num_files++;
+        }
+    }
+    out << num_samples << " samples, " << corpus.size() - num_samples << " generated and file texts from "
+        << num_files << " files\n";
+
+    int failures = 0;
+    for (int i = 0; i < corpus.size(); i++)
+        failures += check_text(i < num_samples ? QString("sample %1").arg(i) : QString("text %1").arg(i), corpus.at(i));
+
+    // Timings for the text as it is passed by xmlSpan
+    QStringList escaped;
+    for (const QString &text : corpus)
+        escaped.append(text.toHtmlEscaped());
+    const QString &start_rwsnippet = span_starts[0];
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int repeat = 0; repeat < repeats; repeat++)
+        for (const QString &text : escaped) sink = old_span(text, start_rwsnippet).size();
+    const qint64 old_ns = qMax(Q_INT64_C(1), timer.nsecsElapsed());
+
+    timer.restart();
+    for (int repeat = 0; repeat < repeats; repeat++)
+        for (const QString &text : escaped) sink = new_span(text, start_rwsnippet).size();
+    const qint64 new_ns = qMax(Q_INT64_C(1), timer.nsecsElapsed());
+
+    out << QString("%1 %2 ms\n").arg("replace", -18).arg(old_ns / 1e6, 9, 'f', 1);
+    out << QString("%1 %2 ms  (%3 x replace)\n").arg("appendLinkedText", -18)
+           .arg(new_ns / 1e6, 9, 'f', 1).arg(double(old_ns) / new_ns, 0, 'f', 2);
+
+    out << (failures ? QString("%1 MISMATCHES\n").arg(failures) : QString("All output identical to QString::replace\n"));
+    return failures ? 1 : 0;
+}
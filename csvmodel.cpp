@@ -21,7 +21,9 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <QtCore/QFile>
 #include <QtCore/QLocale>
 #include <QtCore/QSettings>
+#ifdef Q_OS_WIN
 #include <windows.h>
+#endif
 
 const QString REGIONAL_SEPARATOR_SETTING("csvUseRegionalSeparator");
 
@@ -139,12 +141,17 @@ void CsvModel::setSeparator(const QChar &sep)
     {
         // Determine the CSV separator character from the locale:
         // Ideally QLocale would provide this (see QTBUG-17097)
+#ifdef Q_OS_WIN
         wchar_t output[4];
         if (GetLocaleInfo(GetThreadLocale(), LOCALE_SLIST, output, 4))
         {
             //qDebug() << "Windows LOCALE_SLIST =" << output;
             p_csv_separator = output[0];
         }
+#else
+        // Most locales which use a comma as the decimal point use a semicolon to separate lists
+        p_csv_separator = (QLocale().decimalPoint() == ',') ? ';' : ',';
+#endif
     }
     else
     {
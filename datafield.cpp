@@ -20,16 +20,19 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "realmworksstructure.h"
 #include <QDataStream>
 
-int DataField::p_column_offset{0};
-
-void DataField::setColumnOffset(int offset)
+int  DataField::modelColumn() const
 {
-    p_column_offset = offset;
+    return p_model_column;
 }
 
-int  DataField::modelColumn() const
+/**
+ * @brief DataField::modelColumn
+ * @param column_offset added to the column (for the repetitions of a multiple section)
+ * @return the column to be read, or -1 if this field isn't taken from the model
+ */
+int  DataField::modelColumn(int column_offset) const
 {
-    return p_column_offset + p_model_column;
+    return (p_model_column >= 0) ? p_model_column + column_offset : -1;
 }
 
 QString DataField::fixedText() const
@@ -37,10 +40,10 @@ QString DataField::fixedText() const
     return p_fixed_text;
 }
 
-QVariant DataField::value(const QModelIndex &index) const
+QVariant DataField::value(const QModelIndex &index, int column_offset) const
 {
     if (p_model_column >= 0)
-        return index.sibling(index.row(), modelColumn()).data();
+        return index.sibling(index.row(), p_model_column + column_offset).data();
     else
         return p_fixed_text;
 }
@@ -56,7 +59,7 @@ void DataField::setModelColumn(int column)
 
     p_model_column = column;
     p_fixed_text.clear();
-    emit RealmWorksStructure::theInstance()->modificationDone();
+    if (RealmWorksStructure *rw_structure = RealmWorksStructure::theInstance()) emit rw_structure->modificationDone();
 }
 
 void DataField::setFixedText(const QString &text)
@@ -64,7 +67,7 @@ void DataField::setFixedText(const QString &text)
     if (p_fixed_text == text) return;
     p_model_column = -1;
     p_fixed_text = text;
-    emit RealmWorksStructure::theInstance()->modificationDone();
+    if (RealmWorksStructure *rw_structure = RealmWorksStructure::theInstance()) emit rw_structure->modificationDone();
 }
 
 QDataStream& operator<<(QDataStream &stream, const DataField &item)
@@ -31,12 +31,11 @@ class DataField : public QObject
 public:
     explicit DataField(QObject *parent = nullptr) : QObject(parent) {}
 
-    static void setColumnOffset(int offset);
-
     int  modelColumn() const;
+    int  modelColumn(int column_offset) const;
     QString fixedText() const;
-    QString valueString(const QModelIndex &index = QModelIndex()) const { return value(index).toString(); };
-    QVariant value(const QModelIndex &index = QModelIndex()) const;
+    QString valueString(const QModelIndex &index = QModelIndex(), int column_offset = 0) const { return value(index, column_offset).toString(); };
+    QVariant value(const QModelIndex &index = QModelIndex(), int column_offset = 0) const;
     bool isDefined() const;
 
 public slots:
@@ -46,7 +45,6 @@ public slots:
 private:
     int p_model_column{-1};
     QString p_fixed_text;
-    static int p_column_offset;
     friend QDataStream& operator<<(QDataStream&,const DataField&);
     friend QDataStream& operator>>(QDataStream&,DataField&);
 };
@@ -0,0 +1,121 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "datamodelloader.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QFile>
+
+#include "csvmodel.h"
+#include "excel_xlsxmodel.h"
+#include "jsonmodel.h"
+#include "yamlmodel.h"
+
+/**
+ * @brief loadDataModel
+ * Reads a data file into a new model, choosing the type of model from the file's extension.
+ * (Unlike MainWindow::load_data, this doesn't touch any of the widgets.)
+ *
+ * @param filename The CSV, XLSX, YAML or JSON file to be read.
+ * @param worksheet For XLSX files, the sheet to be selected (if not the default sheet).
+ * @param array_name For JSON files, the array to be selected (if not the default array).
+ * @param parent The owner of the new model.
+ * @return The new model, or nullptr if the file could not be read.
+ */
+QAbstractItemModel *loadDataModel(const QString &filename, const QString &worksheet, const QString &array_name, QObject *parent)
+{
+    if (filename.endsWith(".csv"))
+    {
+        QFile file(filename);
+        if (!file.open(QFile::ReadOnly|QFile::Text))
+        {
+            qWarning() << QObject::tr("Failed to find file") << file.fileName();
+            return nullptr;
+        }
+        CsvModel *model = new CsvModel(parent);
+        model->readCSV(file);
+        return model;
+    }
+    else if (filename.endsWith(".xlsx"))
+    {
+        ExcelXlsxModel *model = new ExcelXlsxModel(filename, parent);
+        if (!worksheet.isEmpty()) model->selectSheet(worksheet);
+        return model;
+    }
+    else if (filename.endsWith(".yaml"))
+    {
+        YamlModel *model = new YamlModel(parent);
+        if (!model->readFile(filename))
+        {
+            qWarning() << QObject::tr("Failed to read YAML file") << filename;
+            delete model;
+            return nullptr;
+        }
+        return model;
+    }
+    else if (filename.endsWith(".json"))
+    {
+        QFile file(filename);
+        if (!file.open(QFile::ReadOnly))
+        {
+            qWarning() << QObject::tr("Failed to find file") << file.fileName();
+            return nullptr;
+        }
+        JsonModel *model = new JsonModel(parent);
+        if (!model->readFile(file))
+        {
+            qWarning() << QObject::tr("Failed to read JSON file") << file.fileName();
+            delete model;
+            return nullptr;
+        }
+        if (!array_name.isEmpty()) model->setArray(array_name);
+        return model;
+    }
+    qCritical() << QObject::tr("Unknown File Extension") << filename;
+    return nullptr;
+}
+
+/**
+ * @brief dataFileHash
+ * @param filename
+ * @return a hash of the contents of the data file (empty if the file can't be read).
+ */
+QByteArray dataFileHash(const QString &filename)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    QFile file(filename);
+    if (file.open(QFile::ReadOnly)) hash.addData(&file);
+    return hash.result();
+}
+
+/**
+ * @brief dataSourceKey
+ * @param file_hash the value from dataFileHash
+ * @param worksheet the worksheet selected (as stored in the project file)
+ * @param array_name the JSON array selected (as stored in the project file)
+ * @return a hash which identifies the data loaded into a model, for validating cached values of derived columns.
+ */
+QByteArray dataSourceKey(const QByteArray &file_hash, const QString &worksheet, const QString &array_name)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(file_hash);
+    hash.addData(worksheet.toUtf8());
+    hash.addData(array_name.toUtf8());
+    return hash.result();
+}
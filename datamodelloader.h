@@ -0,0 +1,36 @@
+#ifndef DATAMODELLOADER_H
+#define DATAMODELLOADER_H
+
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QString>
+#include <QByteArray>
+
+class QAbstractItemModel;
+class QObject;
+
+extern QAbstractItemModel *loadDataModel(const QString &filename,
+                                         const QString &worksheet = QString(),
+                                         const QString &array_name = QString(),
+                                         QObject *parent = nullptr);
+
+extern QByteArray dataFileHash(const QString &filename);
+extern QByteArray dataSourceKey(const QByteArray &file_hash, const QString &worksheet, const QString &array_name);
+
+#endif // DATAMODELLOADER_H
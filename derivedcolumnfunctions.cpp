@@ -0,0 +1,255 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "derivedcolumnfunctions.h"
+
+#include <QAbstractItemModel>
+#include <QDate>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QJSEngine>
+
+#include "datamodelloader.h"
+
+/*
+ * The JS wrappers which are installed as global functions.
+ * (They ensure that the C++ functions always receive all their parameters as the correct types.)
+ */
+static const char *js_wrappers =
+        "function regexExtract(text, pattern, group) { return native.regexExtract(String(text), String(pattern), group === undefined ? 0 : group); }\n"
+        "function regexReplace(text, pattern, replacement) { return native.regexReplace(String(text), String(pattern), String(replacement)); }\n"
+        "function split(text, separator) { return native.split(String(text), String(separator)); }\n"
+        "function join(parts, separator) { return native.join(parts, String(separator)); }\n"
+        "function formatNumber(value, decimals) { return native.formatNumber(String(value), decimals === undefined ? 0 : decimals); }\n"
+        "function normaliseDate(text, format) { return native.normaliseDate(String(text), String(format)); }\n"
+        "function lookup(file, key_column, key_value, result_column) { return native.lookup(String(file), String(key_column), String(key_value), String(result_column)); }\n";
+
+DerivedColumnFunctions::DerivedColumnFunctions(QObject *parent) : QObject(parent)
+{
+}
+
+DerivedColumnFunctions::~DerivedColumnFunctions()
+{
+    clearTables();
+}
+
+///
+/// \brief DerivedColumnFunctions::install
+/// Makes all the functions available as global functions within the supplied engine.
+/// \param engine
+///
+void DerivedColumnFunctions::install(QJSEngine *engine)
+{
+    engine->globalObject().setProperty("native", engine->newQObject(this));
+    QJSValue result = engine->evaluate(js_wrappers);
+    if (result.isError()) qWarning() << "Failed to install derived column functions:" << result.toString();
+}
+
+///
+/// \brief DerivedColumnFunctions::clearTables
+/// Discards all the tables which have been loaded by lookup(), so that they will be read again when next used.
+///
+void DerivedColumnFunctions::clearTables()
+{
+    for (auto table : p_tables)
+    {
+        if (table == nullptr) continue;
+        delete table->model;
+        delete table;
+    }
+    p_tables.clear();
+}
+
+const QRegularExpression &DerivedColumnFunctions::regex(const QString &pattern)
+{
+    auto it = p_regexes.find(pattern);
+    if (it == p_regexes.end())
+    {
+        it = p_regexes.insert(pattern, QRegularExpression(pattern));
+        if (!it->isValid()) qWarning() << "Invalid regular expression" << pattern << ":" << it->errorString();
+    }
+    return *it;
+}
+
+///
+/// \brief DerivedColumnFunctions::regexExtract
+/// \return the text matching the specified capture group (0 = the whole match) of the first match of pattern in text.
+///
+QString DerivedColumnFunctions::regexExtract(const QString &text, const QString &pattern, int group)
+{
+    return regex(pattern).match(text).captured(group);
+}
+
+///
+/// \brief DerivedColumnFunctions::regexReplace
+/// \return text with every match of pattern replaced (\1 etc. in replacement refer to capture groups).
+///
+QString DerivedColumnFunctions::regexReplace(const QString &text, const QString &pattern, const QString &replacement)
+{
+    QString result = text;
+    return result.replace(regex(pattern), replacement);
+}
+
+QStringList DerivedColumnFunctions::split(const QString &text, const QString &separator)
+{
+    return text.split(separator);
+}
+
+QString DerivedColumnFunctions::join(const QVariantList &parts, const QString &separator)
+{
+    QStringList strings;
+    strings.reserve(parts.size());
+    for (const QVariant &part : parts)
+        strings.append(part.toString());
+    return strings.join(separator);
+}
+
+///
+/// \brief DerivedColumnFunctions::formatNumber
+/// \return value with the requested number of decimal places, or value unchanged if it isn't a number.
+///
+QString DerivedColumnFunctions::formatNumber(const QString &value, int decimals)
+{
+    bool ok;
+    double number = value.trimmed().toDouble(&ok);
+    return ok ? QString::number(number, 'f', decimals) : value;
+}
+
+///
+/// \brief DerivedColumnFunctions::normaliseDate
+/// \param format The format of text, as used by QDate::fromString (e.g. "dd/MM/yyyy")
+/// \return the date in YYYY-MM-DD format, or an empty string if text doesn't match the format.
+///
+QString DerivedColumnFunctions::normaliseDate(const QString &text, const QString &format)
+{
+    QDate date = QDate::fromString(text.trimmed(), format);
+    return date.isValid() ? date.toString("yyyy-MM-dd") : QString();
+}
+
+///
+/// \brief DerivedColumnFunctions::setBaseDirectory
+/// \param directory The directory for relative file names passed to lookup() (normally the directory of the main data file).
+///
+void DerivedColumnFunctions::setBaseDirectory(const QString &directory)
+{
+    if (directory == p_base_directory) return;
+    p_base_directory = directory;
+    clearTables();
+}
+
+///
+/// \brief DerivedColumnFunctions::filePath
+/// \param filename The file name passed to lookup()
+/// \return the full path of the file to be read
+///
+QString DerivedColumnFunctions::filePath(const QString &filename) const
+{
+    // (Not relative to the current directory, which is shared by all the projects of a batch export)
+    if (p_base_directory.isEmpty()) return QFileInfo(filename).absoluteFilePath();
+    return QDir(p_base_directory).absoluteFilePath(filename);
+}
+
+///
+/// \brief DerivedColumnFunctions::lookupFiles
+/// Finds the files which will be read by calls to lookup() in a JS expression.
+/// \param expression
+/// \param files Set to the full path of each file
+/// \return false if the files can't be determined (because a file name isn't a literal string)
+///
+bool DerivedColumnFunctions::lookupFiles(const QString &expression, QStringList *files) const
+{
+    static const QRegularExpression any_call("\\blookup\\s*\\(");
+    static const QRegularExpression literal_call("\\blookup\\s*\\(\\s*(['\"])([^'\"]*)\\1\\s*,");
+    files->clear();
+    int calls = 0;
+    QRegularExpressionMatchIterator it = any_call.globalMatch(expression);
+    while (it.hasNext())
+    {
+        it.next();
+        calls++;
+    }
+    it = literal_call.globalMatch(expression);
+    while (it.hasNext())
+    {
+        QString path = filePath(it.next().captured(2));
+        if (!files->contains(path)) files->append(path);
+        calls--;
+    }
+    return calls == 0;
+}
+
+DerivedColumnFunctions::LookupTable *DerivedColumnFunctions::table(const QString &filename)
+{
+    QString path = filePath(filename);
+    auto it = p_tables.constFind(path);
+    if (it != p_tables.constEnd()) return it.value();
+
+    QAbstractItemModel *model = loadDataModel(path);
+    if (model == nullptr)
+    {
+        // (loadDataModel has reported it.) Remember the failure, so that the file isn't read and reported again for every row.
+        p_tables.insert(path, nullptr);
+        return nullptr;
+    }
+
+    LookupTable *table = new LookupTable;
+    table->model = model;
+    int count = model->columnCount();
+    for (int column = 0; column < count; column++)
+    {
+        table->columns.insert(model->headerData(column, Qt::Horizontal).toString(), column);
+    }
+    p_tables.insert(path, table);
+    return table;
+}
+
+///
+/// \brief DerivedColumnFunctions::lookup
+/// Finds the first row in another data file which has key_value in the column key_column.
+/// The file is only read once, and each key column is indexed on its first use.
+/// \param filename The data file (relative to the directory containing the main data file)
+/// \param key_column The name of the column in filename to be searched.
+/// \param key_value The value to be found in key_column.
+/// \param result_column The name of the column whose value is to be returned.
+/// \return The string in result_column of the matching row, or undefined if there is no such row.
+///
+QJSValue DerivedColumnFunctions::lookup(const QString &filename, const QString &key_column, const QString &key_value, const QString &result_column)
+{
+    LookupTable *table = this->table(filename);
+    if (table == nullptr) return QJSValue();
+    int key = table->columns.value(key_column, -1);
+    int result = table->columns.value(result_column, -1);
+    if (key < 0 || result < 0) return QJSValue();
+
+    auto index = table->indexes.find(key);
+    if (index == table->indexes.end())
+    {
+        QHash<QString,int> rows;
+        int count = table->model->rowCount();
+        rows.reserve(count);
+        // Iterate backwards, so that the first matching row is the one remembered
+        for (int row = count-1; row >= 0; row--)
+            rows.insert(table->model->index(row, key).data().toString(), row);
+        index = table->indexes.insert(key, rows);
+    }
+
+    int row = index->value(key_value, -1);
+    if (row < 0) return QJSValue();
+    return table->model->index(row, result).data().toString();
+}
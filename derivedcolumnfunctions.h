@@ -0,0 +1,74 @@
+#ifndef DERIVEDCOLUMNFUNCTIONS_H
+#define DERIVEDCOLUMNFUNCTIONS_H
+
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QObject>
+#include <QHash>
+#include <QJSValue>
+#include <QMap>
+#include <QRegularExpression>
+#include <QStringList>
+#include <QVariantList>
+
+class QAbstractItemModel;
+class QJSEngine;
+
+///
+/// \brief The DerivedColumnFunctions class
+/// Helper functions, implemented in C++, which are made available to the JS expressions
+/// of derived columns as global functions.
+///
+class DerivedColumnFunctions : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DerivedColumnFunctions(QObject *parent = nullptr);
+    ~DerivedColumnFunctions();
+
+    void install(QJSEngine *engine);
+    void clearTables();
+    void setBaseDirectory(const QString &directory);
+    QString filePath(const QString &filename) const;
+    bool lookupFiles(const QString &expression, QStringList *files) const;
+
+    Q_INVOKABLE QString regexExtract(const QString &text, const QString &pattern, int group);
+    Q_INVOKABLE QString regexReplace(const QString &text, const QString &pattern, const QString &replacement);
+    Q_INVOKABLE QStringList split(const QString &text, const QString &separator);
+    Q_INVOKABLE QString join(const QVariantList &parts, const QString &separator);
+    Q_INVOKABLE QString formatNumber(const QString &value, int decimals);
+    Q_INVOKABLE QString normaliseDate(const QString &text, const QString &format);
+    Q_INVOKABLE QJSValue lookup(const QString &filename, const QString &key_column,
+                                const QString &key_value, const QString &result_column);
+
+private:
+    struct LookupTable
+    {
+        QAbstractItemModel *model{nullptr};
+        QMap<QString,int> columns;              // column number for each column name
+        QHash<int, QHash<QString,int>> indexes; // for each key column, the first row with each value
+    };
+    const QRegularExpression &regex(const QString &pattern);
+    LookupTable *table(const QString &filename);
+    QHash<QString,QRegularExpression> p_regexes;
+    QHash<QString,LookupTable*> p_tables;       // nullptr for a file which couldn't be read
+    QString p_base_directory;
+};
+
+#endif // DERIVEDCOLUMNFUNCTIONS_H
@@ -17,27 +17,149 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "derivedcolumnsproxymodel.h"
+#include "derivedcolumnfunctions.h"
 
+#include <QBitArray>
 #include <QJSEngine>
+#include <QRegularExpression>
 #include <QBrush>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QFileInfo>
 #include <QtDebug>
 
+/*
+ * Marks which characters of a JS expression are code, rather than part of a string literal or a comment.
+ * (Regular expression literals are treated as code.)
+ */
+static QBitArray code_positions(const QString &expression)
+{
+    QBitArray result(expression.size());
+    const int size = expression.size();
+    int pos = 0;
+    while (pos < size)
+    {
+        const QChar ch = expression.at(pos);
+        const QChar next = (pos + 1 < size) ? expression.at(pos + 1) : QChar();
+        if (ch == '/' && next == '/')
+        {
+            // Line comment
+            while (pos < size && expression.at(pos) != '\n') pos++;
+        }
+        else if (ch == '/' && next == '*')
+        {
+            // Block comment
+            int end = expression.indexOf("*/", pos + 2);
+            pos = (end < 0) ? size : end + 2;
+        }
+        else if (ch == '\'' || ch == '"' || ch == '`')
+        {
+            // String literal (including its quotes)
+            for (pos++; pos < size && expression.at(pos) != ch; pos++)
+            {
+                if (expression.at(pos) == '\\') pos++;
+            }
+            pos++;
+        }
+        else
+            result.setBit(pos++);
+    }
+    return result;
+}
+
 struct OneColumn
 {
     QString columnName;         // The name of the column.
     QString jsExpression;       // The javascript expression which will be used to generate the values.
+    bool batch{false};          // jsExpression is a function which generates the entire column in one call.
     QVector<QVariant> values;   // The values for each row in the column, calculated using jsExpression.
 
+    // Populated by compile()
+    QString script;             // jsExpression with each row.column('name') replaced by row.value(slot)
+    QJSValue function;          // script wrapped as a function, unless it isn't a simple expression
+    QVector<int> boundColumns;  // model column for each slot used in script
+
+    void compile(QJSEngine *engine, ColumnReader *helper)
+    {
+        // Bind every literal column name to its column number once, rather than
+        // looking up the name on every call from every row.
+        static const QRegularExpression column_call("\\brow\\.column\\(\\s*(['\"])([^'\"]*)\\1\\s*\\)");
+        boundColumns.clear();
+        script.clear();
+        script.reserve(jsExpression.size());
+        const QBitArray is_code = code_positions(jsExpression);
+        int last = 0;
+        QRegularExpressionMatchIterator it = column_call.globalMatch(jsExpression);
+        while (it.hasNext())
+        {
+            QRegularExpressionMatch match = it.next();
+            // Leave text inside strings and comments alone
+            if (!is_code.testBit(match.capturedStart())) continue;
+            int column = helper->columnIndex(match.captured(2));
+            // Leave unknown columns to row.column(), which returns undefined
+            if (column < 0) continue;
+            int slot = boundColumns.indexOf(column);
+            if (slot < 0)
+            {
+                slot = boundColumns.size();
+                boundColumns.append(column);
+            }
+            script.append(jsExpression.midRef(last, match.capturedStart() - last));
+            script.append(QString("row.value(%1)").arg(slot));
+            last = match.capturedEnd();
+        }
+        script.append(jsExpression.midRef(last));
+
+        // A plain expression only needs to be parsed once; anything else (e.g. several
+        // statements) has to be evaluated as a script on each row.
+        function = engine->evaluate("(function() { return (" + script + "\n); })");
+        if (function.isError() || !function.isCallable())
+            function = QJSValue();
+    }
+
+    bool recalculateBatch(QJSEngine *engine, ColumnReader *helper)
+    {
+        int size = helper->model()->rowCount();
+        values.resize(size);
+
+        QJSValue batch = engine->evaluate("(" + jsExpression + "\n)");
+        QJSValue array;
+        if (batch.isCallable())
+            array = batch.call(QJSValueList() << engine->globalObject().property("row"));
+        if (!array.isArray())
+        {
+            qWarning() << "Derived column" << columnName << "function did not return an array:" << (batch.isCallable() ? array.toString() : batch.toString());
+            values.fill("???");
+            return false;
+        }
+        int length = array.property("length").toInt();
+        if (length != size)
+        {
+            qWarning() << "Derived column" << columnName << "function returned" << length << "values, but there are" << size << "rows";
+            values.fill("???");
+            return false;
+        }
+        for (int row=0; row<size; row++)
+        {
+            values[row] = array.property(quint32(row)).toString();
+        }
+        return true;
+    }
+
     bool recalculate(QJSEngine *engine, ColumnReader *helper)
     {
         if (!helper->model()) return false;
+        if (batch) return recalculateBatch(engine, helper);
         bool result = true;
         int size = helper->model()->rowCount();
+        compile(engine, helper);
+        helper->bindColumns(boundColumns);
         values.resize(size);
         for (int row=0; row<size; row++)
         {
             helper->setRow(row);
-            QJSValue value = engine->evaluate(jsExpression).toString();
+            QJSValue value = (function.isCallable() ? function.call() : engine->evaluate(script)).toString();
             if (value.isError())
             {
                 result = false;
@@ -46,6 +168,7 @@ struct OneColumn
             else
                 values[row] = value.toString();
         }
+        helper->releaseColumns();
         return result;
     }
 };
@@ -55,13 +178,71 @@ struct DerivedColumnsProxyModel::PrivateData
     QJSEngine jsEngine;                 // The Javascript Engine to be used for calculating dynamic values.
     QVector<OneColumn> derivedColumns;  // All the added derived-value columns.
     ColumnReader helper;
+    DerivedColumnFunctions functions;   // Global functions available to the JS expressions
 };
 
+///
+/// \brief ColumnReader::bindColumns
+/// Reads the complete contents of each of the given model columns, and converts them to JS values,
+/// so that value() can return them without going through the model, or converting them, on each call.
+/// \param model_columns The column numbers, in the order of the slots used by value().
+///
+void ColumnReader::bindColumns(const QVector<int> &model_columns)
+{
+    bound_values.clear();
+    if (p_model == nullptr) return;
+    int rows = p_model->rowCount();
+    bound_values.reserve(model_columns.size());
+    for (int column : model_columns)
+    {
+        QVector<QJSValue> strings(rows);
+        for (int row = 0; row < rows; row++)
+            strings[row] = QJSValue(p_model->index(row, column).data().toString());
+        bound_values.append(strings);
+    }
+}
+
+void ColumnReader::releaseColumns()
+{
+    bound_values.clear();
+}
+
+QJSValue ColumnReader::columnArray(const QString &name)
+{
+    QJSEngine *engine = qjsEngine(this);
+    int col = columns.value(name, -1);
+    if (engine == nullptr || p_model == nullptr || col == -1) return QJSValue();
+
+    int rows = p_model->rowCount();
+    QJSValue result = engine->newArray(uint(rows));
+    for (int row = 0; row < rows; row++)
+    {
+        result.setProperty(quint32(row), p_model->index(row, col).data().toString());
+    }
+    return result;
+}
+
 ///
 /// \brief DerivedColumnsProxyModel::DerivedColumnsProxyModel
 /// Within the JS expression, access the value of column using:
 ///     row.column('column name')
 ///
+/// Alternatively, a column can be marked as a batch column, in which case the expression is
+/// a JS function which generates the whole column in a single call. It is passed the same 'row' object, and must return an array with
+/// one entry per row:
+///     function(table) { return table.columnArray('column name').map(function(v) { ... }); }
+///
+/// (table.rowCount() gives the number of rows.)
+///
+/// The following global functions are also available:
+///     regexExtract(text, pattern, group)
+///     regexReplace(text, pattern, replacement)
+///     split(text, separator) and join(array, separator)
+///     formatNumber(value, decimals)
+///     normaliseDate(text, format)     e.g. normaliseDate(row.column('date'), 'dd/MM/yyyy')
+///     lookup(file, key_column, key_value, result_column)
+///         e.g. lookup('factions.csv', 'id', row.column('faction_id'), 'name')
+///
 /// \param parent
 ///
 DerivedColumnsProxyModel::DerivedColumnsProxyModel(QObject *parent) :
@@ -69,6 +250,7 @@ DerivedColumnsProxyModel::DerivedColumnsProxyModel(QObject *parent) :
     p(new PrivateData)
 {
     p->jsEngine.globalObject().setProperty("row", p->jsEngine.newQObject(&p->helper));
+    p->functions.install(&p->jsEngine);
     p->helper.setModel(this);
 }
 
@@ -82,6 +264,8 @@ void DerivedColumnsProxyModel::setSourceModel(QAbstractItemModel *sourceModel)
     SuperClass::setSourceModel(sourceModel);
     //p->helper.setModel(sourceModel);
     p->helper.resetColumns();
+    // Re-read lookup tables, in case they have changed along with the main data
+    p->functions.clearTables();
 
     if (!p->derivedColumns.isEmpty())
     {
@@ -97,6 +281,16 @@ void DerivedColumnsProxyModel::setSourceModel(QAbstractItemModel *sourceModel)
     }
 }
 
+///
+/// \brief DerivedColumnsProxyModel::setDataDirectory
+/// Sets the directory in which the files used by lookup() are found. This should be set before the source model.
+/// \param directory
+///
+void DerivedColumnsProxyModel::setDataDirectory(const QString &directory)
+{
+    p->functions.setBaseDirectory(directory);
+}
+
 QVariant DerivedColumnsProxyModel::headerData(int section, Qt::Orientation orientation, int role) const
 {
     //qDebug() << "headerData" << section << orientation << role;
@@ -152,7 +346,8 @@ QVariant DerivedColumnsProxyModel::data(const QModelIndex &index, int role) cons
     if (colnum >= p->derivedColumns.count())
         return QVariant();
 
-    OneColumn &column = p->derivedColumns[colnum];
+    // (const access, since this might be called from several threads at once during an export)
+    const OneColumn &column = p->derivedColumns.at(colnum);
     if (index.row() < 0 || index.row() >= column.values.size())
         return QVariant();
 
@@ -160,7 +355,7 @@ QVariant DerivedColumnsProxyModel::data(const QModelIndex &index, int role) cons
     {
     case Qt::DisplayRole:
     case Qt::EditRole:
-        return column.values[index.row()];
+        return column.values.at(index.row());
     default:
         return QVariant();
     }
@@ -172,9 +367,10 @@ QVariant DerivedColumnsProxyModel::data(const QModelIndex &index, int role) cons
 /// Initialise the javascript for this column to return an empty string.
 /// \param name The name of the new or existing column
 /// \param js_expression The JS expression to be used for the new/existing column.
+/// \param batch true if the expression is a function which generates the entire column.
 /// \return true if the expression was successfully used on all rows.
 ///
-bool DerivedColumnsProxyModel::setColumn(const QString &name, const QString &js_expression)
+bool DerivedColumnsProxyModel::setColumn(const QString &name, const QString &js_expression, bool batch)
 {
     // See if we are modifying an existing column.
     int colnumber=0;
@@ -184,6 +380,7 @@ bool DerivedColumnsProxyModel::setColumn(const QString &name, const QString &js_
         if (col.columnName == name)
         {
             col.jsExpression = js_expression;
+            col.batch = batch;
             result = col.recalculate(&p->jsEngine, &p->helper);
             int fullcolumn = sourceModel()->columnCount() + colnumber;
             emit dataChanged(index(0, fullcolumn), index(rowCount()-1, fullcolumn));
@@ -196,6 +393,7 @@ bool DerivedColumnsProxyModel::setColumn(const QString &name, const QString &js_
     OneColumn newcol;
     newcol.columnName = name;
     newcol.jsExpression = js_expression;
+    newcol.batch = batch;
     result = newcol.recalculate(&p->jsEngine, &p->helper);
     //qDebug() << "setColumn - created new column";
 
@@ -242,6 +440,18 @@ QString DerivedColumnsProxyModel::expression(const QString &name) const
     return "";
 }
 
+bool DerivedColumnsProxyModel::isBatch(const QString &name) const
+{
+    for (OneColumn &col : p->derivedColumns)
+    {
+        if (col.columnName == name)
+        {
+            return col.batch;
+        }
+    }
+    return false;
+}
+
 QStringList DerivedColumnsProxyModel::columnNames() const
 {
     QStringList result;
@@ -254,20 +464,25 @@ QStringList DerivedColumnsProxyModel::columnNames() const
 
 void DerivedColumnsProxyModel::clearColumns()
 {
-    beginRemoveColumns(QModelIndex(), sourceModel()->columnCount(), sourceModel()->columnCount() + p->derivedColumns.count());
+    if (p->derivedColumns.isEmpty()) return;
+    beginRemoveColumns(QModelIndex(), sourceModel()->columnCount(), sourceModel()->columnCount() + p->derivedColumns.count() - 1);
     p->derivedColumns.clear();
     endRemoveColumns();
 }
 
 // Save the configured derived columns to the specified stream
+// (the batch flags follow the columns, so that the file can still be read by older versions)
 extern QDataStream& operator<<(QDataStream &stream, DerivedColumnsProxyModel &model)
 {
     stream << (int)model.p->derivedColumns.count();
+    QVector<bool> batch;
     for (auto col : model.p->derivedColumns)
     {
         stream << col.columnName;
         stream << col.jsExpression;
+        batch.append(col.batch);
     }
+    stream << batch;
     return stream;
 }
 
@@ -283,9 +498,98 @@ extern QDataStream& operator>>(QDataStream &stream, DerivedColumnsProxyModel &mo
         OneColumn col;
         stream >> col.columnName;
         stream >> col.jsExpression;
-        col.recalculate(&model.p->jsEngine, &model.p->helper);
         model.p->derivedColumns.append(col);
     }
+    // Files from older versions don't have the batch flags (so there are no batch columns)
+    QVector<bool> batch;
+    if (!stream.atEnd()) stream >> batch;
+    for (int c=0; c<count; c++)
+    {
+        OneColumn &col = model.p->derivedColumns[c];
+        col.batch = batch.value(c, false);
+        col.recalculate(&model.p->jsEngine, &model.p->helper);
+    }
     model.endResetModel();
     return stream;
 }
+
+
+/*
+ * The cached values of a column are only valid for the same source data, the same expression (and batch flag),
+ * the same earlier derived columns (which it might read) and the same lookup() files.
+ * previous_key is the key of the previous derived column (or the key of the source data for the first column).
+ * An empty key means that the values must always be recalculated.
+ */
+static QByteArray cache_key(const QByteArray &previous_key, const OneColumn &column, const DerivedColumnFunctions &functions)
+{
+    QStringList lookup_files;
+    if (previous_key.isEmpty() || !functions.lookupFiles(column.jsExpression, &lookup_files)) return QByteArray();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(previous_key);
+    hash.addData(column.batch ? "batch|" : "row|");
+    hash.addData(column.jsExpression.toUtf8());
+    for (const QString &file : lookup_files)
+    {
+        QFileInfo info(file);
+        hash.addData(QString("|%1|%2|%3").arg(file).arg(info.size()).arg(info.lastModified().toMSecsSinceEpoch()).toUtf8());
+    }
+    return hash.result();
+}
+
+///
+/// \brief DerivedColumnsProxyModel::saveState
+/// Save the configured derived columns, along with their current values, to the project file.
+/// \param stream
+/// \param source_key A hash identifying the contents of the source data.
+///
+void DerivedColumnsProxyModel::saveState(QDataStream &stream, const QByteArray &source_key) const
+{
+    stream << (int)p->derivedColumns.count();
+    QByteArray key = source_key;
+    for (const OneColumn &col : p->derivedColumns)
+    {
+        key = cache_key(key, col, p->functions);
+        stream << col.columnName;
+        stream << col.jsExpression;
+        stream << col.batch;
+        stream << key;
+        stream << col.values;
+    }
+}
+
+///
+/// \brief DerivedColumnsProxyModel::loadState
+/// Load the derived columns from the project file. The saved values are used if they were
+/// calculated from the same inputs (see cache_key), otherwise the column is recalculated.
+/// \param stream
+/// \param source_key A hash identifying the contents of the current source data.
+/// \param save_version The format of the project file (which only has batch flags from 0x0217).
+///
+void DerivedColumnsProxyModel::loadState(QDataStream &stream, const QByteArray &source_key, int save_version)
+{
+    int count;
+    stream >> count;
+
+    beginResetModel();
+    p->derivedColumns.clear();
+    int rows = sourceModel() ? sourceModel()->rowCount() : 0;
+    QByteArray expected_key = source_key;
+    for (int c=0; c<count; c++)
+    {
+        OneColumn col;
+        QByteArray key;
+        stream >> col.columnName;
+        stream >> col.jsExpression;
+        if (save_version >= 0x0217) stream >> col.batch;
+        stream >> key;
+        stream >> col.values;
+        expected_key = cache_key(expected_key, col, p->functions);
+        if (expected_key.isEmpty() || key != expected_key || col.values.size() != rows)
+        {
+            col.recalculate(&p->jsEngine, &p->helper);
+        }
+        p->derivedColumns.append(col);
+    }
+    endResetModel();
+}
@@ -20,6 +20,7 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 #include <QIdentityProxyModel>
 #include <QJSValue>
+#include <QVector>
 
 class DerivedColumnsProxyModel : public QIdentityProxyModel
 {
@@ -30,6 +31,7 @@ public:
     ~DerivedColumnsProxyModel();
 
     void setSourceModel(QAbstractItemModel *sourceModel) override;
+    void setDataDirectory(const QString &directory);
 
     // Header:
     QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
@@ -43,12 +45,17 @@ public:
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
 
     // Manage derived columns
-    bool setColumn(const QString &name, const QString &js_expression);
+    bool setColumn(const QString &name, const QString &js_expression, bool batch = false);
     bool deleteColumn(const QString &name);
     QString expression(const QString &name) const;
+    bool isBatch(const QString &name) const;
     QStringList columnNames() const;
     void clearColumns();
 
+    // Project files also store the calculated values
+    void saveState(QDataStream &stream, const QByteArray &source_key) const;
+    void loadState(QDataStream &stream, const QByteArray &source_key, int save_version);
+
 private:
     Q_DISABLE_COPY(DerivedColumnsProxyModel)
     typedef QIdentityProxyModel SuperClass;
@@ -87,6 +94,16 @@ public:
 
     inline QAbstractItemModel *model()const { return p_model; }
 
+    ///
+    /// \brief columnIndex
+    /// \param name The name of a column in the model.
+    /// \return The model column number for the named column, or -1 if there is no such column.
+    ///
+    inline int columnIndex(const QString &name) const { return columns.value(name, -1); }
+
+    void bindColumns(const QVector<int> &model_columns);
+    void releaseColumns();
+
     ///
     /// \brief setRow
     /// Sets the current row for use by the column() function
@@ -111,6 +128,32 @@ public:
         return p_model->index(therow, col).data().toString();
     }
     ///
+    /// \brief value
+    /// Invoked from a compiled JS expression in place of column('name').
+    /// \param slot The position of the column in the list passed to bindColumns().
+    /// \return The string of the bound column (in the current row), already converted by bindColumns().
+    ///
+    Q_INVOKABLE QJSValue value(int slot)
+    {
+        return bound_values.at(slot).at(therow);
+    }
+    ///
+    /// \brief columnArray
+    /// Invoked from a batch JS function to read an entire column in one call.
+    /// \param name The name of the column whose values are required.
+    /// \return A JS array holding the string of the specified column for every row.
+    ///
+    Q_INVOKABLE QJSValue columnArray(const QString &name);
+    ///
+    /// \brief rowCount
+    /// Invoked from a batch JS function to find the length of the array to be returned.
+    /// \return The number of rows in the model.
+    ///
+    Q_INVOKABLE int rowCount() const
+    {
+        return p_model ? p_model->rowCount() : 0;
+    }
+    ///
     /// \brief hasColumn
     /// Invoked from a JS script to detect the presence of the named column.
     /// \param name the name of the column whose existence is being tested.
@@ -123,6 +166,7 @@ public:
 private:
     QAbstractItemModel *p_model{nullptr};
     QMap<QString,int> columns;
+    QVector<QVector<QJSValue>> bound_values;    // one entry per bound column, one JS string per row
     int therow{-1};
 };
 
@@ -2,6 +2,7 @@
 #include "ui_errordialog.h"
 #include <QDebug>
 #include <QPushButton>
+#include <QThread>
 
 ErrorDialog::ErrorDialog(QWidget *parent) :
     QDialog(parent),
@@ -26,11 +27,22 @@ ErrorDialog *ErrorDialog::theInstance()
 
 void ErrorDialog::addMessage(const QString &message)
 {
+    // Messages can be reported by the threads which generate the export file
+    if (QThread::currentThread() != thread())
+    {
+        QMetaObject::invokeMethod(this, "addMessage", Qt::QueuedConnection, Q_ARG(QString, message));
+        return;
+    }
     show();
     ui->listWidget->addItem(message);
 }
 
 void ErrorDialog::clear()
 {
+    if (QThread::currentThread() != thread())
+    {
+        QMetaObject::invokeMethod(this, "clear", Qt::QueuedConnection);
+        return;
+    }
     ui->listWidget->clear();
 }
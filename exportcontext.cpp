@@ -0,0 +1,347 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "exportcontext.h"
+
+#include <QAbstractItemModel>
+#include <QAtomicInt>
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include "realmworksstructure.h"
+#include "assetcache.h"
+#include "urlassetfetcher.h"
+#include "imagetransformer.h"
+
+struct ExportContext::SharedState
+{
+    RealmWorksStructure *structure{nullptr};
+    int first_topic_id{0};
+    // When set, the topic ID for each row of the model
+    bool stable_ids{false};
+    QVector<QString> row_topic_ids;
+    // When set, the output file into which each row of the model is put
+    QVector<int> row_shards;
+
+    // For each searched column of the base model, the rows containing each value in that column.
+    // Built on first use, and shared by all relationships which search the same column.
+    QMutex target_rows_mutex;
+    const QAbstractItemModel *indexed_model{nullptr};
+    QHash<int, QHash<QString,QVector<int>>> target_rows;
+
+    // Encoded asset files, shared by all the topics which use them
+    AssetCache asset_cache;
+    // Assets which are given as URLs (unless the structure supplies a fetcher)
+    UrlAssetFetcher own_url_assets;
+    UrlAssetFetcher *url_assets{nullptr};
+    // Downsized copies of pictures
+    ImageTransformer image_transformer;
+
+    QMutex messages_mutex;
+    QStringList messages;
+    QAtomicInt failed{0};
+};
+
+// State which is specific to one output file
+// (only used by the thread which writes that file's parent topics and assembles its output)
+struct ExportContext::ShardState
+{
+    int shard{0};
+    // Topic IDs for topics which aren't generated directly from a row of the model
+    int next_topic_id{0};
+    // The number of times each stable key has been used
+    QHash<QString,int> stable_key_count;
+    // Topics written so far
+    QSet<QString> generated_topics;
+    // Connections which weren't written because their target is in a different file
+    QAtomicInt omitted_connections{0};
+};
+
+/**
+ * @brief ExportContext::ExportContext
+ * Creates the context for a new export.
+ * @param structure the structure being exported
+ * @param first_topic_id the first ID to be returned by allocateTopicId
+ */
+ExportContext::ExportContext(RealmWorksStructure *structure, int first_topic_id) :
+    d(new SharedState),
+    s(new ShardState)
+{
+    d->structure = structure;
+    d->first_topic_id = first_topic_id;
+    d->url_assets = structure->url_assets ? structure->url_assets : &d->own_url_assets;
+    d->image_transformer.setLimits(structure->image_max_dimension, structure->image_quality);
+    s->next_topic_id = first_topic_id;
+}
+
+RealmWorksStructure *ExportContext::structure() const
+{
+    return d->structure;
+}
+
+/**
+ * @brief ExportContext::withColumnOffset
+ * @param offset the offset to be added to the column of each DataField
+ * @return a copy of this context, sharing the same export, but with a different column offset.
+ */
+ExportContext ExportContext::withColumnOffset(int offset) const
+{
+    ExportContext result(*this);
+    result.p_column_offset = offset;
+    return result;
+}
+
+RWDomain *ExportContext::domainById(const QString &domain_id) const
+{
+    return d->structure->domainById(domain_id);
+}
+
+RWDomain *ExportContext::domainByName(const QString &domain_name) const
+{
+    return d->structure->domainByName(domain_name);
+}
+
+QString ExportContext::assetPath(const QString &filename) const
+{
+    return d->structure->assetPath(filename);
+}
+
+AssetCache &ExportContext::assetCache() const
+{
+    return d->asset_cache;
+}
+
+UrlAssetFetcher &ExportContext::urlAssets() const
+{
+    return *d->url_assets;
+}
+
+/**
+ * @brief ExportContext::pictureFile
+ * @param filename the full path to an image used by a Picture or Smart_Image snippet
+ * @return the full path to the file to be put into the export
+ * (a smaller copy of the image, if the project limits the size of images).
+ */
+QString ExportContext::pictureFile(const QString &filename) const
+{
+    return d->image_transformer.transform(filename);
+}
+
+/**
+ * @brief ExportContext::withDeferredAssets
+ * @param deferred receives the large assets which weren't written by writeAssetContents
+ * @return a copy of this context for rendering XML which is later copied to the output file.
+ */
+ExportContext ExportContext::withDeferredAssets(QVector<DeferredAsset> *deferred) const
+{
+    ExportContext result(*this);
+    result.p_deferred_assets = deferred;
+    return result;
+}
+
+/**
+ * @brief ExportContext::writeAssetContents
+ * Writes the base64 encoding of an asset file to the device. Large files which are being rendered into
+ * memory (see withDeferredAssets) are only recorded, and are then written when the XML is put into the file.
+ * @param device
+ * @param filename the full path to the asset file
+ * @return false if the file couldn't be read
+ */
+bool ExportContext::writeAssetContents(QIODevice *device, const QString &filename) const
+{
+    if (p_deferred_assets && QFileInfo(filename).size() > AssetCache::STREAM_THRESHOLD)
+    {
+        p_deferred_assets->append(DeferredAsset{device->pos(), filename});
+        return true;
+    }
+    return d->asset_cache.write(filename, device);
+}
+
+/**
+ * @brief ExportContext::allocateTopicId
+ * @param key identifies the topic (e.g. category and name of a parent topic),
+ * only used when stable topic IDs are required.
+ * @return a new topic id for a topic which isn't generated directly from a row of the model.
+ */
+QString ExportContext::allocateTopicId(const QString &key) const
+{
+    if (d->stable_ids && !key.isEmpty())
+    {
+        // The same key might be used by more than one topic (e.g. parents of the same name in different places)
+        QString result = stableTopicId(key);
+        int count = s->stable_key_count[result]++;
+        return (count == 0) ? result : QString("%1_%2").arg(result).arg(count);
+    }
+    return QString("topic_%1").arg(s->next_topic_id++);
+}
+
+/**
+ * @brief ExportContext::rowTopicId
+ * @param index any cell in a row of the model
+ * @return the topic id of the topic generated from the row of the model.
+ */
+QString ExportContext::rowTopicId(const QModelIndex &index) const
+{
+    if (d->stable_ids && index.row() < d->row_topic_ids.size() && !d->row_topic_ids.at(index.row()).isEmpty())
+        return d->row_topic_ids.at(index.row());
+    return index.data(Qt::UserRole).toString();
+}
+
+bool ExportContext::hasStableTopicIds() const
+{
+    return d->stable_ids;
+}
+
+/**
+ * @brief ExportContext::setStableTopicIds
+ * Use topic IDs which don't depend on the position of the row in the model,
+ * so that a topic has the same ID in each export. This must be called before any topics are written.
+ * @param row_topic_ids the ID of the topic for each row of the model (see stableTopicId)
+ */
+void ExportContext::setStableTopicIds(const QVector<QString> &row_topic_ids)
+{
+    d->stable_ids = true;
+    d->row_topic_ids = row_topic_ids;
+}
+
+/**
+ * @brief ExportContext::stableTopicId
+ * @param key something which identifies the topic
+ * @return a topic ID derived from the key.
+ */
+QString ExportContext::stableTopicId(const QString &key)
+{
+    return "topic_" + QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex().left(20);
+}
+
+/**
+ * @brief ExportContext::checkGeneratedTopic
+ * Records that a topic has been put into the export file, reporting if the same topic has already been written.
+ * @param topic_id
+ * @param public_name
+ */
+void ExportContext::checkGeneratedTopic(const QString &topic_id, const QString &public_name) const
+{
+    if (s->generated_topics.contains(topic_id))
+        // Report the duplicate name
+        addMessage(QObject::tr("Topic '%1' appears in output more than once (the import will fail).").arg(public_name));
+    else
+        s->generated_topics.insert(topic_id);
+}
+
+/**
+ * @brief ExportContext::setRowShards
+ * Records which output file will contain the topic for each row of the model.
+ * This must be called before forShard.
+ * @param row_shards the shard number for each row (or -1 if the row isn't in any file)
+ */
+void ExportContext::setRowShards(const QVector<int> &row_shards)
+{
+    d->row_shards = row_shards;
+}
+
+/**
+ * @brief ExportContext::forShard
+ * @param shard the number of the output file
+ * @return a context for writing one of the files of the export, which shares everything except
+ * the topic IDs and the duplicate topic check with this context.
+ */
+ExportContext ExportContext::forShard(int shard) const
+{
+    ExportContext result(*this);
+    result.s.reset(new ShardState);
+    result.s->shard = shard;
+    result.s->next_topic_id = d->first_topic_id;
+    return result;
+}
+
+/**
+ * @brief ExportContext::rowInOtherShard
+ * @param row
+ * @return true if the topic for the row is being put into a different file of the export
+ * (always false if the export isn't split into several files).
+ */
+bool ExportContext::rowInOtherShard(int row) const
+{
+    int shard = d->row_shards.value(row, -1);
+    return shard >= 0 && shard != s->shard;
+}
+
+void ExportContext::omitConnection() const
+{
+    s->omitted_connections.ref();
+}
+
+int ExportContext::omittedConnections() const
+{
+    return s->omitted_connections.load();
+}
+
+/**
+ * @brief ExportContext::relationshipTargets
+ * @return the rows of the model which have the value in the column.
+ */
+QVector<int> ExportContext::relationshipTargets(const QAbstractItemModel *model, int column, const QString &value) const
+{
+    QMutexLocker lock(&d->target_rows_mutex);   // topics are generated on several threads
+    if (model != d->indexed_model)
+    {
+        d->target_rows.clear();
+        d->indexed_model = model;
+    }
+    if (!d->target_rows.contains(column))
+    {
+        QHash<QString,QVector<int>> &rows = d->target_rows[column];
+        const int maxrow = model->rowCount();
+        for (int row = 0; row < maxrow; row++)
+            rows[model->index(row, column).data().toString()].append(row);
+    }
+    return d->target_rows.value(column).value(value);
+}
+
+void ExportContext::addMessage(const QString &message) const
+{
+    QMutexLocker lock(&d->messages_mutex);
+    d->messages.append(message);
+}
+
+QStringList ExportContext::messages() const
+{
+    QMutexLocker lock(&d->messages_mutex);
+    return d->messages;
+}
+
+/**
+ * @brief ExportContext::fail
+ * Reports a problem after which the output can't be used (e.g. an asset which could only be partly written),
+ * so that the export stops, and is reported as having failed.
+ * @param message
+ */
+void ExportContext::fail(const QString &message) const
+{
+    addMessage(message);
+    d->failed.storeRelease(1);
+}
+
+bool ExportContext::hasFailed() const
+{
+    return d->failed.loadAcquire() != 0;
+}
@@ -0,0 +1,113 @@
+#ifndef EXPORTCONTEXT_H
+#define EXPORTCONTEXT_H
+
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QSharedPointer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QModelIndex>
+#include "datafield.h"
+
+class QAbstractItemModel;
+class QIODevice;
+class AssetCache;
+class ImageTransformer;
+class UrlAssetFetcher;
+class RealmWorksStructure;
+class RWDomain;
+
+/**
+ * @brief The ExportContext class
+ * Everything which changes while a single RWEXPORT file is being generated.
+ * It is passed to every writeToContents call, so that nothing about an export is held in global variables.
+ *
+ * Copies of a context share the state of the export (topic IDs, duplicate checks, messages), which is thread-safe,
+ * but each copy has its own column offset (used when a section is repeated for several groups of columns).
+ *
+ * When the export is split into several files, each file is written with its own copy from forShard
+ * (topic IDs and the duplicate check only apply within a single file).
+ */
+class ExportContext
+{
+public:
+    ExportContext(RealmWorksStructure *structure, int first_topic_id);
+
+    RealmWorksStructure *structure() const;
+
+    // Column offset for the repetitions of a multiple section
+    int columnOffset() const { return p_column_offset; }
+    ExportContext withColumnOffset(int offset) const;
+
+    // Reading data fields (applying the column offset)
+    int column(const DataField &field) const { return field.modelColumn(p_column_offset); }
+    QVariant value(const DataField &field, const QModelIndex &index) const { return field.value(index, p_column_offset); }
+    QString valueString(const DataField &field, const QModelIndex &index) const { return field.valueString(index, p_column_offset); }
+
+    RWDomain *domainById(const QString &domain_id) const;
+    RWDomain *domainByName(const QString &domain_name) const;
+    QString assetPath(const QString &filename) const;
+    AssetCache &assetCache() const;
+    UrlAssetFetcher &urlAssets() const;
+    QString pictureFile(const QString &filename) const;
+
+    // Large assets which are only put into the rendered XML when it is copied to the output file
+    struct DeferredAsset
+    {
+        qint64 offset;          // position in the rendered XML
+        QString filename;
+    };
+    ExportContext withDeferredAssets(QVector<DeferredAsset> *deferred) const;
+    bool writeAssetContents(QIODevice *device, const QString &filename) const;
+
+    QString allocateTopicId(const QString &key = QString()) const;
+    QString rowTopicId(const QModelIndex &index) const;
+
+    // Topic IDs which don't change between exports (for incremental exports)
+    bool hasStableTopicIds() const;
+    void setStableTopicIds(const QVector<QString> &row_topic_ids);
+    static QString stableTopicId(const QString &key);
+    void checkGeneratedTopic(const QString &topic_id, const QString &public_name) const;
+    QVector<int> relationshipTargets(const QAbstractItemModel *model, int column, const QString &value) const;
+
+    // Splitting the export into several files
+    void setRowShards(const QVector<int> &row_shards);
+    ExportContext forShard(int shard) const;
+    bool rowInOtherShard(int row) const;
+    void omitConnection() const;
+    int omittedConnections() const;
+
+    // Problems found while generating the export
+    void addMessage(const QString &message) const;
+    QStringList messages() const;
+    // Problems which leave the output unusable
+    void fail(const QString &message) const;
+    bool hasFailed() const;
+
+private:
+    struct SharedState;
+    struct ShardState;
+    QSharedPointer<SharedState> d;
+    QSharedPointer<ShardState> s;
+    int p_column_offset{0};
+    QVector<DeferredAsset> *p_deferred_assets{nullptr};
+};
+
+#endif // EXPORTCONTEXT_H
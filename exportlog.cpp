@@ -0,0 +1,59 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "exportlog.h"
+
+static thread_local ExportLog *current_log = nullptr;
+
+void ExportLog::addMessage(const QString &message)
+{
+    QMutexLocker lock(&mutex);
+    p_messages.append(message);
+}
+
+QStringList ExportLog::messages() const
+{
+    QMutexLocker lock(&mutex);
+    return p_messages;
+}
+
+int ExportLog::count() const
+{
+    QMutexLocker lock(&mutex);
+    return p_messages.count();
+}
+
+/**
+ * @brief ExportLog::current
+ * @return the log which should receive messages reported by the current thread (or nullptr)
+ */
+ExportLog *ExportLog::current()
+{
+    return current_log;
+}
+
+ExportLog::Scope::Scope(ExportLog *log) :
+    previous(current_log)
+{
+    current_log = log;
+}
+
+ExportLog::Scope::~Scope()
+{
+    current_log = previous;
+}
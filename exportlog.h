@@ -0,0 +1,57 @@
+#ifndef EXPORTLOG_H
+#define EXPORTLOG_H
+
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QMutex>
+#include <QStringList>
+
+/**
+ * @brief The ExportLog class
+ * Collects the warnings reported while loading and exporting one project,
+ * so that several projects can be processed at the same time (see BatchRunner).
+ *
+ * The log which receives messages from the current thread is set using ExportLog::Scope.
+ */
+class ExportLog
+{
+public:
+    void addMessage(const QString &message);
+    QStringList messages() const;
+    int count() const;
+
+    static ExportLog *current();
+
+    // Directs messages from the current thread to a log for the lifetime of the Scope.
+    class Scope
+    {
+    public:
+        explicit Scope(ExportLog *log);
+        ~Scope();
+    private:
+        ExportLog *previous;
+        Q_DISABLE_COPY(Scope)
+    };
+
+private:
+    mutable QMutex mutex;
+    QStringList p_messages;
+};
+
+#endif // EXPORTLOG_H
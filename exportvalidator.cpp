@@ -0,0 +1,219 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "exportvalidator.h"
+
+#include <QAbstractItemModel>
+#include <QFileInfo>
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QUrl>
+#include <QVector>
+#include <QtConcurrent>
+
+#include "realmworksstructure.h"
+#include "rw_alias.h"
+#include "rw_domain.h"
+#include "rw_facet.h"
+#include "rw_section.h"
+#include "rw_snippet.h"
+#include "rw_topic.h"
+#include "urlassetfetcher.h"
+
+namespace {
+
+// A snippet, and the column offset at which it reads its fields (which differs for each repetition of a multiple section)
+struct SnippetCheck
+{
+    const RWSnippet *snippet;
+    int offset;
+};
+
+void add_snippet_checks(const RWContentsItem *item, const QVector<int> &offsets, int column_count, QVector<SnippetCheck> &checks)
+{
+    QVector<int> child_offsets = offsets;
+    if (const RWSection *section = qobject_cast<const RWSection*>(item))
+    {
+        if (section->p_is_multiple && section->firstMultiple().modelColumn() >= 0 && section->secondMultiple().modelColumn() >= 0)
+        {
+            int first_column = section->firstMultiple().modelColumn();
+            int last_column  = section->lastMultiple().modelColumn();
+            if (last_column < 0) last_column = column_count;
+            int step = section->secondMultiple().modelColumn() - first_column;
+            if (step > 0)
+            {
+                child_offsets.clear();
+                for (int offset : offsets)
+                    for (int column = first_column; column <= last_column; column += step)
+                        child_offsets.append(offset + column - first_column);
+            }
+        }
+    }
+    else if (const RWSnippet *snippet = qobject_cast<const RWSnippet*>(item))
+    {
+        for (int offset : offsets)
+            checks.append(SnippetCheck{snippet, offset});
+    }
+    for (auto child: item->childItems<RWContentsItem*>())
+        add_snippet_checks(child, child_offsets, column_count, checks);
+}
+
+typedef QVector<QPair<int,QString>> RowFindings;
+
+/**
+ * @brief The CheckRowFunctor struct
+ * Finds the problems with one row of the model, for one body topic.
+ */
+struct CheckRowFunctor
+{
+    typedef RowFindings result_type;
+    const RealmWorksStructure *structure;
+    const QAbstractItemModel *model;
+    const RWTopic *topic;
+    QVector<SnippetCheck> checks;
+
+    RowFindings operator()(int row) const
+    {
+        RowFindings result;
+        const QModelIndex index = model->index(row, 0);
+        auto report = [&result, row](const QString &message) { result.append(qMakePair(row, message)); };
+
+        // Aliases (see RWTopic::writeStartToContents)
+        const QString public_name = topic->publicName().namefield().valueString(index);
+        QStringList known_names(public_name);
+        for (auto alias: topic->aliases)
+        {
+            QString name = alias->namefield().valueString(index);
+            if (name.isEmpty()) continue;
+            if (!known_names.contains(name))
+                known_names.append(name);
+            else if (name == public_name)
+                report(QObject::tr("Can't create alias with same name as topic: '%1'").arg(name));
+            else
+                report(QObject::tr("Same alias '%1' appears more than once in topic '%2'").arg(name).arg(public_name));
+        }
+
+        for (const SnippetCheck &check : checks)
+        {
+            const RWSnippet *snippet = check.snippet;
+            const RWFacet::SnippetType type = snippet->facet->snippetType();
+
+            if (type == RWFacet::Numeric)
+            {
+                const QString digits = snippet->number().valueString(index, check.offset);
+                bool ok = true;
+                if (!digits.isEmpty()) digits.toFloat(&ok);
+                if (!ok) report(QObject::tr("Non-numeric characters in numeric field: %1").arg(digits));
+            }
+            else if (type == RWFacet::Date_Game || type == RWFacet::Date_Range)
+            {
+                const QString start_date = snippet->startDate().valueString(index, check.offset);
+                if (!start_date.isEmpty() && !RWSnippet::isValidDate(start_date))
+                    report(RWSnippet::invalidDateMessage(start_date));
+                if (type == RWFacet::Date_Range && !start_date.isEmpty())
+                {
+                    const QString finish_date = snippet->finishDate().valueString(index, check.offset);
+                    if (!RWSnippet::isValidDate(finish_date))
+                        report(RWSnippet::invalidDateMessage(finish_date));
+                }
+            }
+
+            const QVariant asset = snippet->filename().value(index, check.offset);
+            if (asset.type() == QVariant::String && !asset.toString().isEmpty() &&
+                    !QFileInfo(structure->assetPath(asset.toString())).isFile() &&
+                    !UrlAssetFetcher::isRemote(QUrl(asset.toString())))
+                report("File/URL does not exist: " + asset.toString());
+
+            const QString tag_names = snippet->tags().valueString(index, check.offset);
+            if (!tag_names.isEmpty())
+            {
+                const QString domain_id = snippet->structure->attributes().value("domain_id").toString();
+                if (const RWDomain *domain = structure->domainById(domain_id))
+                {
+                    for (auto &tag : domain->tagList(tag_names))
+                        if (tag.second.isEmpty())
+                            report(QString("No TAG defined for \"%1\" in DOMAIN \"%2\"").arg(tag.first).arg(domain->name()));
+                }
+            }
+        }
+        return result;
+    }
+};
+
+}
+
+ExportValidator::ExportValidator(const RealmWorksStructure *structure, const QAbstractItemModel *model) :
+    p_structure(structure),
+    p_model(model)
+{
+}
+
+/**
+ * @brief ExportValidator::validate
+ * @param body_topics the topics to be generated from the rows of the model
+ * @param stable_topic_ids true if the export will use stable topic IDs (see ExportContext::setStableTopicIds)
+ * @return a description of each problem found (with the data rows on which it was found),
+ * or an empty list if nothing is wrong.
+ */
+QStringList ExportValidator::validate(const QList<RWTopic*> &body_topics, bool stable_topic_ids) const
+{
+    const int column_count = p_model->columnCount();
+
+    // message => data rows on which it occurs
+    QMap<QString,QVector<int>> findings;
+    // The same rows as are exported for each topic
+    const QVector<RealmWorksStructure::ExportUnit> units = p_structure->exportRows(body_topics, p_model);
+
+    // Body topics get their topic ID from the row (see ExportContext::rowTopicId),
+    // so check for duplicates among the same IDs as the export will use.
+    const QVector<QString> stable_ids = stable_topic_ids ? RealmWorksStructure::stableTopicIds(units, p_model) : QVector<QString>();
+    QHash<QString,int> id_count;
+    for (const RealmWorksStructure::ExportUnit &unit : units)
+        for (int row : unit.rows)
+        {
+            const QString topic_id = stable_topic_ids ? stable_ids.at(row) : p_model->index(row, 0).data(Qt::UserRole).toString();
+            // Each row is only listed once, no matter how many topics use it
+            if (++id_count[topic_id] == 2)
+                findings[QObject::tr("Row is used by more than one topic, so its topic appears in output more than once (the import will fail).")].append(row);
+        }
+
+    for (const RealmWorksStructure::ExportUnit &unit : units)
+    {
+        CheckRowFunctor functor{p_structure, p_model, unit.topic, {}};
+        add_snippet_checks(unit.topic, QVector<int>{0}, column_count, functor.checks);
+        const QVector<RowFindings> results = QtConcurrent::blockingMapped<QVector<RowFindings>>(unit.rows, functor);
+        for (const RowFindings &row_findings : results)
+            for (auto &finding : row_findings)
+                findings[finding.second].append(finding.first);
+    }
+
+    QStringList result;
+    for (auto it = findings.constBegin(); it != findings.constEnd(); ++it)
+    {
+        const QVector<int> &rows = it.value();
+        QStringList listed;
+        for (int i = 0; i < rows.size() && i < MAX_ROWS_LISTED; i++)
+            listed.append(QString::number(rows.at(i) + 1));
+        QString where = (rows.size() == 1 ? QObject::tr("data row %1") : QObject::tr("data rows %1")).arg(listed.join(", "));
+        if (rows.size() > MAX_ROWS_LISTED)
+            where += QObject::tr(" and %n more", "", rows.size() - MAX_ROWS_LISTED);
+        result.append(QString("%1 (%2)").arg(it.key(), where));
+    }
+    return result;
+}
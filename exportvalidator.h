@@ -0,0 +1,58 @@
+#ifndef EXPORTVALIDATOR_H
+#define EXPORTVALIDATOR_H
+
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QList>
+#include <QStringList>
+
+class QAbstractItemModel;
+class RealmWorksStructure;
+class RWTopic;
+
+/**
+ * @brief The ExportValidator class
+ * Checks every row of the data against the topics to be exported, without generating anything,
+ * so that problems which would otherwise only be reported part of the way through a long export
+ * can be found (and fixed) before the export is started:
+ *  - rows which would produce the same topic more than once;
+ *  - aliases which repeat the topic's name, or another alias;
+ *  - unknown tags;
+ *  - non-numeric values in Numeric snippets;
+ *  - badly formatted dates;
+ *  - asset files which don't exist.
+ *
+ * The rows are checked concurrently. Identical findings from several rows are reported together.
+ */
+class ExportValidator
+{
+public:
+    ExportValidator(const RealmWorksStructure *structure, const QAbstractItemModel *model);
+
+    QStringList validate(const QList<RWTopic*> &body_topics, bool stable_topic_ids = false) const;
+
+    // Maximum number of rows listed for each finding
+    static const int MAX_ROWS_LISTED = 5;
+
+private:
+    const RealmWorksStructure *p_structure;
+    const QAbstractItemModel *p_model;
+};
+
+#endif // EXPORTVALIDATOR_H
@@ -48,6 +48,9 @@ void FileDetails::showEvent(QShowEvent *event)
     ui->credits->setPlainText(rw_structure->details_credits);
     ui->legal->setPlainText(rw_structure->details_legal);
     ui->otherNotes->setPlainText(rw_structure->details_other_notes);
+
+    ui->imageMaxDimension->setValue(rw_structure->image_max_dimension);
+    ui->imageQuality->setValue(rw_structure->image_quality);
 }
 
 void FileDetails::on_fileDetails_accepted()
@@ -62,4 +65,7 @@ void FileDetails::on_fileDetails_accepted()
     rw_structure->details_credits = ui->credits->toPlainText();
     rw_structure->details_legal = ui->legal->toPlainText();
     rw_structure->details_other_notes = ui->otherNotes->toPlainText();
+
+    rw_structure->image_max_dimension = ui->imageMaxDimension->value();
+    rw_structure->image_quality = ui->imageQuality->value();
 }
@@ -0,0 +1,146 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "imagetransformer.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+ImageTransformer::ImageTransformer(const QString &cache_directory) :
+    p_cache_directory(cache_directory)
+{
+}
+
+/**
+ * @brief ImageTransformer::defaultCacheDirectory
+ * @return the directory used for converted images unless another is specified.
+ */
+QString ImageTransformer::defaultCacheDirectory()
+{
+    QString location = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    return location.isEmpty() ? QDir::temp().absoluteFilePath("RWImporter/images") : location + "/images";
+}
+
+/**
+ * @brief ImageTransformer::setLimits
+ * This must be called before the transformer is used.
+ * @param max_dimension the maximum width and height of an image (zero to leave all images unchanged)
+ * @param quality the JPEG quality (1 to 100)
+ */
+void ImageTransformer::setLimits(int max_dimension, int quality)
+{
+    p_max_dimension = qMax(0, max_dimension);
+    p_quality = qBound(1, quality, 100);
+}
+
+/**
+ * @brief ImageTransformer::transform
+ * @param filename the full path to the image
+ * @return the full path of the file to be put into the export in place of the image
+ * (which is the original file if it doesn't need to be changed, or can't be read as an image).
+ */
+QString ImageTransformer::transform(const QString &filename)
+{
+    if (!isEnabled()) return filename;
+    QFileInfo info(filename);
+    if (!info.isFile()) return filename;
+
+    QSharedPointer<Entry> item;
+    {
+        QMutexLocker lock(&mutex);
+        QSharedPointer<Entry> &entry = entries[QString("%1|%2|%3").arg(info.absoluteFilePath())
+                .arg(info.size()).arg(info.lastModified().toMSecsSinceEpoch())];
+        if (entry.isNull()) entry.reset(new Entry);
+        item = entry;
+    }
+    // Several topics might use the same image at the same time
+    QMutexLocker lock(&item->mutex);
+    if (!item->done)
+    {
+        item->result = convert(info);
+        item->done = true;
+    }
+    return item->result;
+}
+
+/**
+ * @brief ImageTransformer::convert
+ * @param info the source image
+ * @return the converted image in the cache directory, or the source image if it is to be used as it is.
+ */
+QString ImageTransformer::convert(const QFileInfo &info) const
+{
+    const QString original = info.absoluteFilePath();
+
+    // The file itself isn't read unless it has to be converted
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QString("%1|%2|%3|%4|%5").arg(original).arg(info.size()).arg(info.lastModified().toMSecsSinceEpoch())
+                 .arg(p_max_dimension).arg(p_quality).toUtf8());
+    const QDir cache_dir(p_cache_directory);
+    const QString base = cache_dir.absoluteFilePath(hash.result().toHex());
+
+    // Converted by an earlier export?
+    for (const char *suffix : {".jpg", ".png"})
+    {
+        if (QFileInfo::exists(base + suffix)) return base + suffix;
+    }
+
+    QImageReader reader(original);
+    reader.setAutoTransform(true);
+    const QSize size = reader.size();
+    if (!size.isValid()) return original;       // not an image
+
+    // Only images which are too big are changed
+    if (qMax(size.width(), size.height()) <= p_max_dimension) return original;
+
+    // Decoding at the smaller size is much faster for JPEG files
+    reader.setScaledSize(size.scaled(p_max_dimension, p_max_dimension, Qt::KeepAspectRatio));
+    QImage image = reader.read();
+    if (image.isNull())
+    {
+        qWarning().noquote() << QObject::tr("Failed to read image %1: %2").arg(original, reader.errorString());
+        return original;
+    }
+
+    if (!cache_dir.exists() && !QDir().mkpath(p_cache_directory))
+    {
+        qWarning().noquote() << QObject::tr("Failed to create image cache directory %1").arg(p_cache_directory);
+        return original;
+    }
+
+    // JPEG doesn't support transparency
+    const bool has_alpha = image.hasAlphaChannel();
+    const QString converted = base + (has_alpha ? ".png" : ".jpg");
+    QSaveFile output(converted);
+    if (!output.open(QFile::WriteOnly) ||
+            !image.save(&output, has_alpha ? "PNG" : "JPG", has_alpha ? -1 : p_quality) ||
+            !output.commit())
+    {
+        qWarning().noquote() << QObject::tr("Failed to write converted image %1").arg(converted);
+        return original;
+    }
+    return converted;
+}
@@ -0,0 +1,70 @@
+#ifndef IMAGETRANSFORMER_H
+#define IMAGETRANSFORMER_H
+
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+
+class QFileInfo;
+
+/**
+ * @brief The ImageTransformer class
+ * Reduces the size of the images used for Picture and Smart_Image snippets, by scaling down any image
+ * which is larger than the maximum dimension and re-encoding it as JPEG at the chosen quality
+ * (images with transparency are kept as PNG). Images within the maximum dimension are used as they are.
+ *
+ * The converted images are kept in a cache directory, named after a hash of the source file's path, size
+ * and modification time (the same as IncrementalState::rowHash) and the settings,
+ * so each image is only converted once, even across exports.
+ * The transformer may be used by several threads at once.
+ */
+class ImageTransformer
+{
+public:
+    explicit ImageTransformer(const QString &cache_directory = defaultCacheDirectory());
+
+    void setLimits(int max_dimension, int quality);
+    bool isEnabled() const { return p_max_dimension > 0; }
+    QString transform(const QString &filename);
+
+    static QString defaultCacheDirectory();
+
+    static const int DEFAULT_QUALITY = 85;
+
+private:
+    struct Entry
+    {
+        QMutex mutex;
+        bool done{false};
+        QString result;
+    };
+    QString convert(const QFileInfo &info) const;
+
+    QMutex mutex;
+    QHash<QString,QSharedPointer<Entry>> entries;
+    QString p_cache_directory;
+    int p_max_dimension{0};
+    int p_quality{DEFAULT_QUALITY};
+    Q_DISABLE_COPY(ImageTransformer)
+};
+
+#endif // IMAGETRANSFORMER_H
@@ -0,0 +1,225 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "incrementalstate.h"
+
+#include <QAbstractItemModel>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QSaveFile>
+
+#include "realmworksstructure.h"
+#include "rw_section.h"
+#include "rw_snippet.h"
+#include "rw_facet.h"
+#include "rw_topic.h"
+
+static const quint32 STATE_MAGIC   = 0x52575354;    // "RWST"
+static const qint32  STATE_VERSION = 1;
+
+/**
+ * @brief IncrementalState::stateFileName
+ * @param output_file the RWEXPORT file being generated
+ * @return the name of the file holding the state of the previous export to output_file
+ */
+QString IncrementalState::stateFileName(const QString &output_file)
+{
+    QFileInfo info(output_file);
+    return info.absoluteDir().absoluteFilePath(info.completeBaseName() + ".rwstate");
+}
+
+/**
+ * @brief IncrementalState::load
+ * Reads the state of the previous export. A missing file isn't an error (everything is treated as new).
+ * @param filename
+ * @return false if the file exists but couldn't be read
+ */
+bool IncrementalState::load(const QString &filename)
+{
+    p_previous_mapping_hash.clear();
+    p_previous_rows.clear();
+
+    QFile file(filename);
+    if (!file.exists()) return true;
+    if (!file.open(QFile::ReadOnly))
+    {
+        qWarning().noquote() << QObject::tr("Failed to open incremental state file %1").arg(filename);
+        return false;
+    }
+    QDataStream stream(&file);
+    quint32 magic;
+    qint32 version;
+    stream >> magic >> version;
+    if (magic != STATE_MAGIC || version != STATE_VERSION)
+    {
+        qWarning().noquote() << QObject::tr("Ignoring incremental state file %1 (unknown format)").arg(filename);
+        return false;
+    }
+    stream >> p_previous_mapping_hash;
+    stream >> p_previous_rows;
+    if (stream.status() != QDataStream::Ok)
+    {
+        qWarning().noquote() << QObject::tr("Incremental state file %1 is corrupt").arg(filename);
+        p_previous_mapping_hash.clear();
+        p_previous_rows.clear();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief IncrementalState::save
+ * Writes the hashes of the rows seen in this export, to be compared against on the next run.
+ * This should only be called once the export file has been written completely.
+ * @param filename
+ * @return true if the file was written
+ */
+bool IncrementalState::save(const QString &filename) const
+{
+    QSaveFile file(filename);
+    if (!file.open(QFile::WriteOnly))
+    {
+        qWarning().noquote() << QObject::tr("Failed to create incremental state file %1").arg(filename);
+        return false;
+    }
+    QDataStream stream(&file);
+    stream << STATE_MAGIC << STATE_VERSION;
+    stream << p_mapping_hash;
+    stream << p_current_rows;
+    return file.commit();
+}
+
+/**
+ * @brief IncrementalState::rowChanged
+ * Records the hash of a topic for the next run.
+ * @param topic_id the stable ID of the topic
+ * @param row_hash the hash from rowHash
+ * @return true if the topic is new, or has changed, since the previous export (or the mapping has changed).
+ */
+bool IncrementalState::rowChanged(const QString &topic_id, const QByteArray &row_hash)
+{
+    p_current_rows.insert(topic_id, row_hash);
+    bool changed = mappingChanged() || p_previous_rows.value(topic_id) != row_hash;
+    if (changed) p_changed_count++;
+    return changed;
+}
+
+static void add_asset_columns(const RWContentsItem *item, const QVector<int> &offsets, int column_count,
+                              QVector<int> &columns, QVector<int> *picture_columns)
+{
+    QVector<int> child_offsets = offsets;
+    if (const RWSection *section = qobject_cast<const RWSection*>(item))
+    {
+        if (section->p_is_multiple && section->firstMultiple().modelColumn() >= 0 && section->secondMultiple().modelColumn() >= 0)
+        {
+            // Each repetition of the section reads its fields at a different offset
+            int first_column = section->firstMultiple().modelColumn();
+            int last_column  = section->lastMultiple().modelColumn();
+            if (last_column < 0) last_column = column_count;
+            int step = section->secondMultiple().modelColumn() - first_column;
+            if (step > 0)
+            {
+                child_offsets.clear();
+                for (int offset : offsets)
+                    for (int column = first_column; column <= last_column; column += step)
+                        child_offsets.append(offset + column - first_column);
+            }
+        }
+    }
+    else if (const RWSnippet *snippet = qobject_cast<const RWSnippet*>(item))
+    {
+        for (int offset : offsets)
+        {
+            int column = snippet->filename().modelColumn(offset);
+            if (column >= 0 && column < column_count && !columns.contains(column))
+            {
+                columns.append(column);
+                if (picture_columns && (snippet->facet->snippetType() == RWFacet::Picture ||
+                                        snippet->facet->snippetType() == RWFacet::Smart_Image))
+                    picture_columns->append(column);
+            }
+        }
+    }
+    for (auto child: item->childItems<RWContentsItem*>())
+        add_asset_columns(child, child_offsets, column_count, columns, picture_columns);
+}
+
+/**
+ * @brief IncrementalState::assetColumns
+ * @param topic
+ * @param column_count the number of columns in the model
+ * @param picture_columns if not null, receives those columns which are used by Picture or Smart_Image snippets
+ * @return the columns which contain the names of asset files for the topic
+ */
+QVector<int> IncrementalState::assetColumns(const RWTopic *topic, int column_count, QVector<int> *picture_columns)
+{
+    QVector<int> columns;
+    add_asset_columns(topic, QVector<int>{0}, column_count, columns, picture_columns);
+    return columns;
+}
+
+/**
+ * @brief IncrementalState::rowHash
+ * @param model
+ * @param row
+ * @param asset_columns the columns containing asset file names (see assetColumns)
+ * @param structure used to locate the asset files
+ * @return a hash of every column of the row, along with the size and modification time of each asset file.
+ */
+QByteArray IncrementalState::rowHash(const QAbstractItemModel *model, int row, const QVector<int> &asset_columns,
+                                     const RealmWorksStructure *structure)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    const int columns = model->columnCount();
+    for (int column = 0; column < columns; column++)
+    {
+        QVariant value = model->index(row, column).data();
+        if (value.type() == QVariant::Image)
+        {
+            // Only the pixels of each scanline, since the padding at the end of each one isn't initialised
+            const QImage image = value.value<QImage>();
+            QByteArray details;
+            QDataStream stream(&details, QIODevice::WriteOnly);
+            stream << image.width() << image.height() << int(image.format());
+            hash.addData(details);
+            const int line_bytes = (image.width() * image.depth() + 7) / 8;
+            for (int y = 0; y < image.height(); y++)
+                hash.addData(reinterpret_cast<const char*>(image.constScanLine(y)), line_bytes);
+        }
+        else
+            hash.addData(value.toString().toUtf8());
+        hash.addData("\0", 1);
+    }
+    for (int column : asset_columns)
+    {
+        QFileInfo info(structure->assetPath(model->index(row, column).data().toString()));
+        if (info.isFile())
+        {
+            QByteArray details;
+            QDataStream stream(&details, QIODevice::WriteOnly);
+            stream << info.size() << info.lastModified().toMSecsSinceEpoch();
+            hash.addData(details);
+        }
+    }
+    return hash.result();
+}
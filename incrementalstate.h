@@ -0,0 +1,65 @@
+#ifndef INCREMENTALSTATE_H
+#define INCREMENTALSTATE_H
+
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+class QAbstractItemModel;
+class RealmWorksStructure;
+class RWTopic;
+
+/**
+ * @brief The IncrementalState class
+ * The content hashes of the topics put into the previous export of a project (stored in a .rwstate file
+ * alongside the RWEXPORT file), so that the next export need only contain the topics which have changed.
+ *
+ * Topics are identified by their stable topic ID (see ExportContext::setStableTopicIds), since row numbers
+ * change whenever rows are added to or removed from the data.
+ * If the mapping hash (of the project file) differs from the previous run then every topic is treated as changed.
+ */
+class IncrementalState
+{
+public:
+    bool load(const QString &filename);
+    bool save(const QString &filename) const;
+    static QString stateFileName(const QString &output_file);
+
+    void setMappingHash(const QByteArray &hash) { p_mapping_hash = hash; }
+    bool mappingChanged() const { return p_mapping_hash != p_previous_mapping_hash; }
+
+    bool rowChanged(const QString &topic_id, const QByteArray &row_hash);
+    int changedCount() const { return p_changed_count; }
+
+    static QVector<int> assetColumns(const RWTopic *topic, int column_count, QVector<int> *picture_columns = nullptr);
+    static QByteArray rowHash(const QAbstractItemModel *model, int row, const QVector<int> &asset_columns,
+                              const RealmWorksStructure *structure);
+
+private:
+    QByteArray p_mapping_hash;
+    QByteArray p_previous_mapping_hash;
+    QHash<QString,QByteArray> p_previous_rows;
+    QHash<QString,QByteArray> p_current_rows;
+    int p_changed_count{0};
+};
+
+#endif // INCREMENTALSTATE_H
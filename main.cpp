@@ -18,17 +18,39 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "mainwindow.h"
 #include <QApplication>
+#include <QAtomicInt>
+#include <QCommandLineParser>
+#include <QDir>
 #include <QMessageBox>
+#include <QThread>
+#include "batchexport.h"
+#include "batchrunner.h"
+#include "exportlog.h"
 #include "errordialog.h"
 
 static QtMessageHandler orig_handler;
 
+// In batch mode there are no widgets, so issues are counted and sent to stderr
+static bool batch_mode = false;
+static QAtomicInt batch_issue_count;
+
 static void message_handler(QtMsgType type, const QMessageLogContext &context, const QString &message)
 {
     switch (type)
     {
     case QtWarningMsg:
     case QtCriticalMsg:
+        if (batch_mode)
+        {
+            batch_issue_count.ref();
+            // Messages about a specific project are reported with that project
+            if (ExportLog *log = ExportLog::current())
+            {
+                log->addMessage(message);
+                return;
+            }
+            break;
+        }
         // Display the issue to the user
         ErrorDialog::theInstance()->addMessage(message);
         return;
@@ -43,10 +65,102 @@ static void message_handler(QtMsgType type, const QMessageLogContext &context, c
 }
 
 
+/**
+ * @brief run_batch_export
+ * Generates an RWEXPORT file without any user interaction:
+ *
+ *     RealmWorksImport --project x.csv2rw --out y.rwexport [--data override.csv] [--incremental] [--shard-topics N] [--shard-size MB] [--validate]
+ *     RealmWorksImport --manifest projects.txt [--jobs N] [--incremental] [--shard-topics N] [--shard-size MB] [--validate]
+ *
+ * With --incremental, the output only contains the topics which are new or changed since the previous
+ * incremental export to the same file (the hashes of the previous run are kept in a .rwstate file).
+ * With --shard-topics or --shard-size, the output is split into y_001.rwexport, y_002.rwexport, ...
+ * With --validate, all the rows are checked before anything is written, and the export isn't written if any problems are found.
+ *
+ * @return the exit code for the application: 0 if the export was created without any issues being reported.
+ */
+static int run_batch_export(QCoreApplication &app)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QCoreApplication::translate("main", "Generate a Realm Works® export file from a project file."));
+    parser.addHelpOption();
+    QCommandLineOption project_option("project", QCoreApplication::translate("main", "The project file to be exported."), "file");
+    QCommandLineOption output_option("out",      QCoreApplication::translate("main", "The RWEXPORT file to be created."), "file");
+    QCommandLineOption data_option("data",       QCoreApplication::translate("main", "Data file to use instead of the one in the project."), "file");
+    QCommandLineOption manifest_option("manifest", QCoreApplication::translate("main", "File listing the projects to be exported."), "file");
+    QCommandLineOption jobs_option("jobs",         QCoreApplication::translate("main", "Maximum number of projects to export at once."), "count");
+    QCommandLineOption incremental_option("incremental", QCoreApplication::translate("main", "Only export topics which have changed since the previous export."));
+    QCommandLineOption shard_topics_option("shard-topics", QCoreApplication::translate("main", "Split the output into files of at most this many topics."), "count");
+    QCommandLineOption shard_size_option("shard-size",     QCoreApplication::translate("main", "Split the output into files of about this many megabytes."), "MB");
+    QCommandLineOption validate_option("validate", QCoreApplication::translate("main", "Check all the data first, and don't export if any problems are found."));
+    parser.addOption(project_option);
+    parser.addOption(output_option);
+    parser.addOption(data_option);
+    parser.addOption(manifest_option);
+    parser.addOption(jobs_option);
+    parser.addOption(incremental_option);
+    parser.addOption(shard_topics_option);
+    parser.addOption(shard_size_option);
+    parser.addOption(validate_option);
+    parser.process(app);
+
+    if (!parser.isSet(manifest_option) && (!parser.isSet(project_option) || !parser.isSet(output_option)))
+    {
+        qCritical().noquote() << QCoreApplication::translate("main", "Either --manifest, or both --project and --out, must be specified");
+        return 2;
+    }
+
+    RealmWorksStructure::ShardLimits limits;
+    if (parser.isSet(shard_topics_option)) limits.max_topics = parser.value(shard_topics_option).toInt();
+    if (parser.isSet(shard_size_option))   limits.max_bytes  = parser.value(shard_size_option).toLongLong() * 1024 * 1024;
+    if (limits.max_topics < 0 || limits.max_bytes < 0)
+    {
+        qCritical().noquote() << QCoreApplication::translate("main", "Invalid shard limit");
+        return 2;
+    }
+
+    if (parser.isSet(manifest_option))
+    {
+        int jobs = parser.isSet(jobs_option) ? parser.value(jobs_option).toInt() : QThread::idealThreadCount();
+        return BatchRunner().run(QDir::current().absoluteFilePath(parser.value(manifest_option)), jobs,
+                                 parser.isSet(incremental_option), limits, parser.isSet(validate_option));
+    }
+
+    QString project_file = QDir::current().absoluteFilePath(parser.value(project_option));
+    QString output_file  = QDir::current().absoluteFilePath(parser.value(output_option));
+    QString data_file    = parser.isSet(data_option) ? QDir::current().absoluteFilePath(parser.value(data_option)) : QString();
+
+    BatchExport exporter;
+    bool ok = exporter.loadProject(project_file, data_file) && exporter.writeExport(output_file, parser.isSet(incremental_option), limits,
+                                                                                    parser.isSet(validate_option));
+    for (auto &message : exporter.log().messages())
+        orig_handler(QtWarningMsg, QMessageLogContext(), message);
+    if (!ok) return 1;
+
+    return (batch_issue_count.load() > 0) ? 1 : 0;
+}
+
+
 int main(int argc, char *argv[])
 {
     orig_handler = qInstallMessageHandler(message_handler);
 
+    // Command-line exports don't need (or necessarily have) a display
+    for (int i = 1; i < argc; i++)
+    {
+        if (qstrcmp(argv[i], "--project") == 0 || qstrncmp(argv[i], "--project=", 10) == 0 ||
+            qstrcmp(argv[i], "--manifest") == 0 || qstrncmp(argv[i], "--manifest=", 11) == 0)
+            batch_mode = true;
+    }
+    if (batch_mode)
+    {
+        QCoreApplication app(argc, argv);
+        QCoreApplication::setOrganizationName("Amusing Time");
+        QCoreApplication::setOrganizationDomain("amusingtime.uk");
+        QCoreApplication::setApplicationName("RWImporter");
+        return run_batch_export(app);
+    }
+
     QApplication a(argc, argv);
     QCoreApplication::setOrganizationName("Amusing Time");
     QCoreApplication::setOrganizationDomain("amusingtime.uk");
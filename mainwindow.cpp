@@ -24,9 +24,11 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "yamlmodel.h"
 #include "jsonmodel.h"
 #include "derivedcolumnsproxymodel.h"
+#include "datamodelloader.h"
 #include "columnnamemodel.h"
 #include "addcolumndialog.h"
 
+#include <QApplication>
 #include <QDebug>
 #include <QMessageBox>
 #include <QFile>
@@ -37,6 +39,9 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <QStringListModel>
 #include <QSettings>
 #include <QCloseEvent>
+#include <QFutureWatcher>
+#include <QProgressDialog>
+#include <QtConcurrent>
 #include <rw_topic_widget.h>
 
 #include "rw_topic.h"
@@ -52,6 +57,9 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #endif
 #include "rw_relationship.h"
 #include "rw_relationship_widget.h"
+#include "errordialog.h"
+#include "exportvalidator.h"
+#include "projectfile.h"
 
 static const QString PROJECT_DIRECTORY_PARAM("csvProjectDirectory");
 static const QString DATA_DIRECTORY_PARAM("csvDirectory");
@@ -143,6 +151,27 @@ MainWindow::MainWindow(const QString &filename, QWidget *parent) :
 
     connect(&rw_structure, &RealmWorksStructure::modificationDone, [=]{setWindowModified(true);});
 
+    // Exports run in the background, with a non-modal progress dialog
+    // (and the error dialog must exist on this thread before any export reports to it)
+    ErrorDialog::theInstance();
+    export_watcher = new QFutureWatcher<bool>(this);
+    connect(export_watcher, &QFutureWatcher<bool>::finished, this, &MainWindow::export_finished);
+    validate_watcher = new QFutureWatcher<QStringList>(this);
+    connect(validate_watcher, &QFutureWatcher<QStringList>::finished, this, &MainWindow::validation_finished);
+    export_progress = new QProgressDialog(this);
+    export_progress->setWindowTitle(tr("Progress"));
+    export_progress->setAutoReset(false);
+    export_progress->setAutoClose(false);
+    export_progress->reset();
+    export_progress->hide();
+    connect(export_progress, &QProgressDialog::canceled, [=] { rw_structure.cancelExport(); });
+    connect(&rw_structure, &RealmWorksStructure::exportProgress, export_progress,
+            [=](int value, int maximum, const QString &label) {
+        export_progress->setLabelText(label);
+        export_progress->setMaximum(maximum);
+        export_progress->setValue(value);
+    });
+
     // Read current (Default) option
     on_actionForce_Format_3_toggled(ui->actionForce_Format_3->isChecked());
 
@@ -176,7 +205,10 @@ MainWindow::MainWindow(const QString &filename, QWidget *parent) :
     AddColumnDialog *acd = new AddColumnDialog(this);
     connect(acd, &AddColumnDialog::updateColumn, derived_columns, &DerivedColumnsProxyModel::setColumn);
     connect(acd, &AddColumnDialog::deleteColumn, derived_columns, &DerivedColumnsProxyModel::deleteColumn);
-    connect(acd, &AddColumnDialog::requestExpression,  [=](const QString &name) { acd->setExpression(derived_columns->expression(name)); });
+    connect(acd, &AddColumnDialog::requestExpression,  [=](const QString &name) {
+        acd->setExpression(derived_columns->expression(name));
+        acd->setBatch(derived_columns->isBatch(name));
+    });
     connect(acd, &AddColumnDialog::requestColumnNames, [=]() { acd->setColumnNames(derived_columns->columnNames()); });
 
     connect(ui->derivedColumns, &QPushButton::clicked, acd, &QDialog::show);
@@ -194,16 +226,14 @@ void MainWindow::set_project_filename(const QString &filename)
     setWindowTitle(base_window_title + " : " + filename + "[*]");
 }
 
-const QString VERSION_LABEL{"VERSION"};
-
 bool MainWindow::save_project(const QString &filename)
 {
     //qDebug() << "Saving project to" << filename;
     QFile file(filename);
     if (!file.open(QFile::WriteOnly)) return false;
     QDataStream stream(&file);
-    stream << VERSION_LABEL;
-    stream << 0x0214;   // save file version number
+    stream << ProjectFile::VERSION_LABEL;
+    stream << ProjectFile::CURRENT_VERSION;   // save file version number
     stream << ui->dataFilename->text();
     stream << ui->sheetName->currentText();
     stream << ui->arrayName->currentText();
@@ -230,8 +260,8 @@ bool MainWindow::save_project(const QString &filename)
     }
     // Optional extra check box saved
     stream << ui->actionForce_Format_3->isChecked();
-    // Any custom columns
-    stream << *derived_columns;
+    // Any custom columns (with their values)
+    derived_columns->saveState(stream, data_source_key());
 
     setWindowModified(false);
     return true;
@@ -240,95 +270,43 @@ bool MainWindow::save_project(const QString &filename)
 bool MainWindow::load_project(const QString &filename)
 {
     //qDebug() << "Loading project from" << filename;
-    QFile file(filename);
-    if (!file.open(QFile::ReadOnly)) return false;
-    QDataStream stream(&file);
-
-    QString datafile;
-    QString worksheet;
-    QString array_name;
-    QString structurefile;
-    QString current_topic;
+    ProjectFile project;
+    if (!project.open(filename)) return false;
 
-    // Read parameters in order (Versions 2.9 onwards has VERSION as first keyword)
-    int save_file_version = 0x0208;
-    stream >> datafile;
-    if (datafile == VERSION_LABEL)  // Save versions from v2.8 and earlier didn't have this keyword
-    {
-        stream >> save_file_version;
-        stream >> datafile;
-    }
-    qApp->setProperty("saveVersion", save_file_version);
-    qDebug() << "Loading save file in format" << QString::number(save_file_version, 16);
+    // The old derived columns will be replaced, so don't recalculate them on the new data.
+    derived_columns->clearColumns();
 
-    stream >> worksheet;
-    if (save_file_version >= 0x0214)
+    if (!load_data(project.data_file, project.worksheet))
     {
-        stream >> array_name;
-    }
-    stream >> structurefile;
-    stream >> current_topic;
-
-    if (!load_data(datafile, worksheet))
-    {
-        QMessageBox::critical(this, tr("Load Project Failed"), tr("Failed to load data from %1").arg(datafile));
+        QMessageBox::critical(this, tr("Load Project Failed"), tr("Failed to load data from %1").arg(project.data_file));
         return false;
     }
     if (derived_columns->sourceModel() == json_model)
     {
-        json_model->setArray(array_name);
+        json_model->setArray(project.array_name);
     }
-    if (!load_structure(structurefile))
+    if (!load_structure(project.structure_file))
     {
-        QMessageBox::critical(this, tr("Load Project Failed"), tr("Failed to load structure from %1").arg(structurefile));
+        QMessageBox::critical(this, tr("Load Project Failed"), tr("Failed to load structure from %1").arg(project.structure_file));
         return false;
     }
-    rw_structure.loadState(stream);
-
-    // Get the list of configured topics
-    QStringList topic_list;
-    stream >> topic_list;
-    //qDebug() << "Loading topics" << topic_list;
 
-    // Create a lookup table of the known categories
-    QMap<QString,RWCategory*> cat_map;
-    for (auto cat: rw_structure.categories)
-        cat_map.insert(cat->name(), cat);
-
-    // Now all the defined column mappings
-    for (auto name : topic_list)
+    if (!project.readContents(&rw_structure, &p_all_topics, derived_columns, data_source_key()))
     {
-        RWCategory *category = cat_map.value(name, nullptr);
-        if (category)
-        {
-            RWTopic *topic = qobject_cast<RWTopic*>(category->createContentsTree());
-            stream >> *topic;
-            p_all_topics.insert(name, topic);
-        }
-        else
-        {
-            qDebug() << "MainWindow::load_project:" << name << "not in category list";
-            stream.setStatus(QDataStream::ReadCorruptData);
-        }
+        // As in earlier versions, carry on with the topics which were read before the problem
+        // (the rest of the file, including the derived columns, can't be read).
+        qWarning().noquote() << project.errorString();
+        derived_columns->clearColumns();
     }
-
-    // Some optional addition stuff
-    if (!stream.atEnd())
+    if (project.has_force_format3)
     {
-        // Optional flag that contains ForceFormat3 flag
-        bool flag;
-        stream >> flag;
-        ui->actionForce_Format_3->setChecked(flag);
-        on_actionForce_Format_3_toggled(flag);
+        ui->actionForce_Format_3->setChecked(project.force_format3);
+        on_actionForce_Format_3_toggled(project.force_format3);
     }
-    if (save_file_version >= 0x0212)
-        stream >> *derived_columns;
-    else
-        derived_columns->clearColumns();
 
-    ui->categoryComboBox->setCurrentText(current_topic);
+    ui->categoryComboBox->setCurrentText(project.current_topic);
     // Force loading of correct field mappings
-    on_categoryComboBox_currentTextChanged(current_topic);
+    on_categoryComboBox_currentTextChanged(project.current_topic);
 
     setWindowModified(false);
     set_project_filename(filename);
@@ -382,6 +360,15 @@ void MainWindow::saveProjectAs()
     }
 }
 
+/**
+ * @brief MainWindow::data_source_key
+ * @return a hash which identifies the data currently loaded into the model.
+ */
+QByteArray MainWindow::data_source_key() const
+{
+    return dataSourceKey(data_file_hash, ui->sheetName->currentText(), ui->arrayName->currentText());
+}
+
 bool MainWindow::load_data(const QString &filename, const QString &worksheet)
 {
     //qDebug() << "MainWindow::load_data" << filename;
@@ -489,12 +476,16 @@ bool MainWindow::load_data(const QString &filename, const QString &worksheet)
     }
     ui->dataFilename->setText(filename);
 
+    // Identify the contents of the file, for validating cached values of derived columns
+    data_file_hash = dataFileHash(filename);
+
     // Remember the data directory
     settings.setValue(DATA_DIRECTORY_PARAM, QFileInfo(filename).absolutePath());
 
     // Switch to the data directory, in case we need to load images.
     QDir::setCurrent(QFileInfo(filename).absolutePath());
 
+    derived_columns->setDataDirectory(QFileInfo(filename).absolutePath());
     derived_columns->setSourceModel(model);
 
     //qDebug() << "Model size: " << model->rowCount() << "rows and" << model->columnCount() << "columns";
@@ -649,6 +640,19 @@ void MainWindow::closeEvent(QCloseEvent *event)
 {
     if (discardChanges("Are you sure that you want to quit?"))
     {
+        // Don't leave an export running in the background
+        if (validate_watcher->isRunning())
+        {
+            // (The check can't be interrupted, and mustn't go on to start the export.)
+            validate_watcher->disconnect(this);
+            validate_watcher->waitForFinished();
+        }
+        if (export_watcher->isRunning())
+        {
+            rw_structure.cancelExport();
+            export_watcher->waitForFinished();
+            export_finished();
+        }
         event->accept();
     }
     else
@@ -660,9 +664,6 @@ void MainWindow::closeEvent(QCloseEvent *event)
 
 void MainWindow::on_generateButton_clicked()
 {
-    QSettings settings;
-    const QString OUTPUT_DIRECTORY_PARAM("outputDirectory");
-
     ui->generateButton->setEnabled(false);
 
     // Check that the topic has been configured correctly.
@@ -689,6 +690,64 @@ void MainWindow::on_generateButton_clicked()
         used_topics.insert(widget->topic());
     }
 
+    // Check all the rows now, rather than finding the problems part of the way through the export.
+    // This reads every row, so it runs in the background (the data mustn't change until it has finished).
+    centralWidget()->setEnabled(false);
+    menuBar()->setEnabled(false);
+
+    export_progress->reset();   // clear any previous cancellation
+    export_progress->setLabelText(tr("Checking data..."));
+    export_progress->setRange(0, 0);
+    export_progress->show();
+
+    const ExportValidator validator(&rw_structure, proxy->sourceModel());
+    validate_watcher->setFuture(QtConcurrent::run(validator, &ExportValidator::validate,
+                                                  p_all_topics.values(), /*stable_topic_ids*/ false));
+}
+
+/**
+ * @brief MainWindow::validation_finished
+ * Called when the background check of the data has finished, to report what it found
+ * and then (unless cancelled) ask for the output file and start the export.
+ */
+void MainWindow::validation_finished()
+{
+    export_progress->hide();
+    centralWidget()->setEnabled(true);
+    menuBar()->setEnabled(true);
+    if (export_progress->wasCanceled())
+    {
+        ui->generateButton->setEnabled(true);
+        return;
+    }
+
+    const QStringList findings = validate_watcher->result();
+    if (!findings.isEmpty())
+    {
+        QMessageBox box(QMessageBox::Warning, tr("Problems Found"),
+                        tr("%n problem(s) were found in the data, so the import into Realm Works® might fail.", "", findings.size()),
+                        QMessageBox::Yes | QMessageBox::No, this);
+        box.setInformativeText(tr("Do you want to generate the export file anyway?"));
+        box.setDetailedText(findings.join('\n'));
+        box.setDefaultButton(QMessageBox::No);
+        if (box.exec() != QMessageBox::Yes)
+        {
+            ui->generateButton->setEnabled(true);
+            return;
+        }
+    }
+    start_export();
+}
+
+/**
+ * @brief MainWindow::start_export
+ * Asks for the name of the output file, and then starts the export in the background.
+ */
+void MainWindow::start_export()
+{
+    QSettings settings;
+    const QString OUTPUT_DIRECTORY_PARAM("outputDirectory");
+
     // Prompt for output filename
     QString filename = QFileDialog::getSaveFileName(this,
                                                     /*caption*/ tr("Realm Works® Export File"),
@@ -700,32 +759,67 @@ void MainWindow::on_generateButton_clicked()
         return;
     }
 
-    QFile file(filename);
+    export_file = new QFile(filename, this);
     // On windows, the creation time-stamp needs to be created properly
-    if (file.exists() && !file.remove())
+    if (export_file->exists() && !export_file->remove())
     {
-        qWarning() << tr("Failed to remove old file") << file.fileName();
+        qWarning() << tr("Failed to remove old file") << export_file->fileName();
+        delete export_file;
+        export_file = nullptr;
         ui->generateButton->setEnabled(true);
         return;
     }
 
-    if (!file.open(QFile::WriteOnly))
+    if (!export_file->open(QFile::WriteOnly))
     {
-        qWarning() << tr("Failed to create file") << file.fileName();
+        qWarning() << tr("Failed to create file") << export_file->fileName();
+        delete export_file;
+        export_file = nullptr;
         ui->generateButton->setEnabled(true);
         return;
     }
 
-    settings.setValue(OUTPUT_DIRECTORY_PARAM, QFileInfo(file).absolutePath());
+    settings.setValue(OUTPUT_DIRECTORY_PARAM, QFileInfo(*export_file).absolutePath());
 
-    QList<RWTopic*> parent_topics;
-    for (auto widget: parents)
-        parent_topics.append(widget->topic());
+    // The data and topic definitions must not change while the export is running in the background.
+    centralWidget()->setEnabled(false);
+    menuBar()->setEnabled(false);
+
+    ErrorDialog::theInstance()->clear();
+    export_progress->reset();   // clear any previous cancellation
+    export_progress->setLabelText(tr("Generating topics/articles..."));
+    export_progress->setRange(0, 0);
+    export_progress->show();
 
+    rw_structure.clearCancel();
     // TODO - parent_topics is specific to each RWTopic
-    rw_structure.writeExportFile(&file, p_all_topics.values(), proxy->sourceModel());
-    file.close();
+    export_watcher->setFuture(QtConcurrent::run(&rw_structure, &RealmWorksStructure::writeExportFile,
+                                                export_file, p_all_topics.values(),
+                                                static_cast<const QAbstractItemModel*>(proxy->sourceModel()),
+                                                static_cast<IncrementalState*>(nullptr)));
+}
+
+/**
+ * @brief MainWindow::export_finished
+ * Called when the background export has stopped (either completed or cancelled).
+ */
+void MainWindow::export_finished()
+{
+    if (export_file == nullptr) return;
+
+    export_progress->hide();
+    export_file->close();
+    // Don't leave a partial export file lying around
+    if (!export_watcher->result())
+    {
+        qWarning() << tr("Export cancelled") << export_file->fileName();
+        export_file->remove();
+    }
+    delete export_file;
+    export_file = nullptr;
 
+    centralWidget()->setEnabled(true);
+    menuBar()->setEnabled(true);
     // Enable button again (so that we know it is finished
     ui->generateButton->setEnabled(true);
 }
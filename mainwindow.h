@@ -37,6 +37,9 @@ class RWRelationshipWidget;
 class YamlModel;
 class JsonModel;
 class DerivedColumnsProxyModel;
+class QFile;
+class QProgressDialog;
+template <typename T> class QFutureWatcher;
 
 class MainWindow : public QMainWindow
 {
@@ -94,11 +97,20 @@ private:
     QMap<QString, RWTopic*> p_all_topics;
     QString base_window_title;
     QString project_name;
+    QByteArray data_file_hash;
+    QFutureWatcher<bool> *export_watcher{nullptr};
+    QFutureWatcher<QStringList> *validate_watcher{nullptr};
+    QProgressDialog *export_progress{nullptr};
+    QFile *export_file{nullptr};
+    void export_finished();
+    void validation_finished();
+    void start_export();
     bool load_project(const QString &filename);
     bool save_project(const QString &filename);
     void set_project_filename(const QString &filename);
     bool load_structure(const QString &filename);
     bool load_data(const QString &filename, const QString &worksheet = QString());
+    QByteArray data_source_key() const;
     void set_current_topic(const QString &selection);
     bool discardChanges(const QString &msg);
 };
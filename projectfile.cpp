@@ -0,0 +1,139 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "projectfile.h"
+
+#include <QDebug>
+#include <QFile>
+
+#include "derivedcolumnsproxymodel.h"
+#include "realmworksstructure.h"
+#include "rw_category.h"
+#include "rw_topic.h"
+
+const QString ProjectFile::VERSION_LABEL{"VERSION"};
+
+/**
+ * @brief ProjectFile::open
+ * Reads the project file, and the parameters at the start of it.
+ * @param filename
+ * @return false if the file can't be read
+ */
+bool ProjectFile::open(const QString &filename)
+{
+    QFile file(filename);
+    if (!file.open(QFile::ReadOnly))
+    {
+        p_error = QObject::tr("Failed to open project file %1").arg(filename);
+        return false;
+    }
+    p_filename = filename;
+    p_contents = file.readAll();
+    p_buffer.setBuffer(&p_contents);
+    p_buffer.open(QBuffer::ReadOnly);
+    p_stream.setDevice(&p_buffer);
+
+    // Read parameters in order (Versions 2.9 onwards has VERSION as first keyword)
+    p_version = 0x0208;
+    p_stream >> data_file;
+    if (data_file == VERSION_LABEL)  // Save versions from v2.8 and earlier didn't have this keyword
+    {
+        p_stream >> p_version;
+        p_stream >> data_file;
+    }
+    qDebug() << "Loading save file in format" << QString::number(p_version, 16);
+
+    p_stream >> worksheet;
+    if (p_version >= 0x0214)
+    {
+        p_stream >> array_name;
+    }
+    p_stream >> structure_file;
+    p_stream >> current_topic;
+
+    if (p_stream.status() != QDataStream::Ok)
+    {
+        p_error = QObject::tr("Project file %1 is corrupt").arg(filename);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief ProjectFile::readContents
+ * Reads the rest of the project, once the data and structure files named at the start of it have been loaded.
+ * @param structure the loaded structure, which receives the saved details
+ * @param topics receives the configured topics (created from the categories of structure), by category name
+ * @param derived_columns receives the derived columns (its source model must already be set)
+ * @param source_key identifies the current contents of the data (see dataSourceKey)
+ * @return false if the project doesn't match the structure, or is corrupt.
+ * The topics which were read before the problem are still put into topics, so the GUI can carry on with them;
+ * BatchExport treats it as fatal, since it mustn't export a partial project.
+ */
+bool ProjectFile::readContents(RealmWorksStructure *structure,
+                               QMap<QString,RWTopic*> *topics,
+                               DerivedColumnsProxyModel *derived_columns,
+                               const QByteArray &source_key)
+{
+    structure->loadState(p_stream, p_version);
+
+    // Get the list of configured topics
+    QStringList topic_list;
+    p_stream >> topic_list;
+
+    // Create a lookup table of the known categories
+    QMap<QString,RWCategory*> cat_map;
+    for (auto cat: structure->categories)
+        cat_map.insert(cat->name(), cat);
+
+    // Now all the defined column mappings
+    for (auto name : topic_list)
+    {
+        RWCategory *category = cat_map.value(name, nullptr);
+        if (category == nullptr)
+        {
+            // The rest of the file can't be read without knowing the contents of this topic
+            p_error = QObject::tr("Category %1 is not in the structure file").arg(name);
+            return false;
+        }
+        RWTopic *topic = qobject_cast<RWTopic*>(category->createContentsTree());
+        topic->loadState(p_stream, p_version);
+        topics->insert(name, topic);
+    }
+
+    // Some optional addition stuff
+    if (!p_stream.atEnd())
+    {
+        // Optional flag that contains ForceFormat3 flag
+        p_stream >> force_format3;
+        has_force_format3 = true;
+    }
+    if (p_version >= 0x0215)
+        derived_columns->loadState(p_stream, source_key, p_version);
+    else if (p_version >= 0x0212)
+        p_stream >> *derived_columns;
+    else
+        derived_columns->clearColumns();
+
+    if (p_stream.status() != QDataStream::Ok)
+    {
+        p_error = QObject::tr("Project file %1 is corrupt").arg(p_filename);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef PROJECTFILE_H
+#define PROJECTFILE_H
+
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QBuffer>
+#include <QByteArray>
+#include <QDataStream>
+#include <QMap>
+#include <QString>
+
+class DerivedColumnsProxyModel;
+class RealmWorksStructure;
+class RWTopic;
+
+/**
+ * @brief The ProjectFile class
+ * Reads a project file (as written by MainWindow::save_project), without creating any widgets.
+ *
+ * The file is read in two steps: open() reads the names of the data and structure files,
+ * which must then be loaded by the caller before readContents() reads the rest of the project into them.
+ */
+class ProjectFile
+{
+public:
+    ProjectFile() = default;
+
+    bool open(const QString &filename);
+    bool readContents(RealmWorksStructure *structure,
+                      QMap<QString,RWTopic*> *topics,
+                      DerivedColumnsProxyModel *derived_columns,
+                      const QByteArray &source_key);
+
+    int version() const { return p_version; }
+    const QByteArray &contents() const { return p_contents; }
+    QString errorString() const { return p_error; }
+
+    // From the start of the file (the names are as saved, so might be relative)
+    QString data_file;
+    QString worksheet;
+    QString array_name;
+    QString structure_file;
+    QString current_topic;
+
+    // The optional "Force Format 3" flag (only if has_force_format3 is set)
+    bool has_force_format3{false};
+    bool force_format3{false};
+
+    // The first item of a project file (files from v2.8 and earlier don't have it)
+    static const QString VERSION_LABEL;
+    // The format written by this version of the application
+    static const int CURRENT_VERSION = 0x0217;
+
+private:
+    QString p_filename;
+    QByteArray p_contents;
+    QBuffer p_buffer;
+    QDataStream p_stream;
+    int p_version{0x0208};
+    QString p_error;
+    Q_DISABLE_COPY(ProjectFile)
+};
+
+#endif // PROJECTFILE_H
@@ -20,13 +20,23 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <QXmlStreamReader>
 #include <QDebug>
 #include <QAbstractItemModel>
-#include <QProgressBar>
-#include <QProgressDialog>
 #include <QCoreApplication>
-#include <QSortFilterProxyModel>
+#include <QDir>
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QSet>
+#include <QTemporaryFile>
+#include <QThread>
+#include <QtConcurrent>
 
 #include "rw_topic.h"
-#include "rw_topic.h"
+#include "exportlog.h"
+#include "exportcontext.h"
+#include "assetcache.h"
+#include "incrementalstate.h"
+#include "urlassetfetcher.h"
 
 #undef DUMP_ON_LOAD
 
@@ -43,18 +53,61 @@ static void dump_tree(int indent, RWStructureItem *parent)
 }
 #endif
 
-static RealmWorksStructure *the_instance = nullptr;
+// The structure being edited by the GUI (each thread which loads projects has its own)
+static thread_local RealmWorksStructure *the_instance = nullptr;
 
 RealmWorksStructure::RealmWorksStructure(QObject *parent) : QObject(parent)
 {
     the_instance = this;
 }
 
+RealmWorksStructure::~RealmWorksStructure()
+{
+    if (the_instance == this) the_instance = nullptr;
+}
+
 RealmWorksStructure *RealmWorksStructure::theInstance()
 {
     return the_instance;
 }
 
+/**
+ * @brief RealmWorksStructure::owner
+ * @param item an element of a loaded structure file (or anything else parented to one)
+ * @return the RealmWorksStructure which loaded the item, or nullptr
+ */
+RealmWorksStructure *RealmWorksStructure::owner(const QObject *item)
+{
+    for (QObject *obj = item ? item->parent() : nullptr; obj != nullptr; obj = obj->parent())
+    {
+        RealmWorksStructure *result = qobject_cast<RealmWorksStructure*>(obj);
+        if (result) return result;
+    }
+    return nullptr;
+}
+
+/**
+ * @brief RealmWorksStructure::assetPath
+ * @param filename the name of an asset file, as it appears in the data
+ * @return the path to be used to open the file
+ */
+QString RealmWorksStructure::assetPath(const QString &filename) const
+{
+    if (data_directory.isEmpty()) return filename;
+    return QDir(data_directory).absoluteFilePath(filename);
+}
+
+RWDomain *RealmWorksStructure::domainById(const QString &domain_id) const
+{
+    if (domain_id.isEmpty()) return nullptr;
+    return domains_by_id.value(domain_id);
+}
+
+RWDomain *RealmWorksStructure::domainByName(const QString &domain_name) const
+{
+    return domains_by_name.value(domain_name);
+}
+
 /**
  * @brief RealmWorksStructure::loadFile
  * @param file
@@ -68,6 +121,8 @@ void RealmWorksStructure::loadFile(QIODevice *device)
     if (reader.readNextStartElement())
     {
         export_element = read_element(&reader, nullptr);
+        // So that the elements can find the structure to which they belong
+        export_element->setParent(this);
     }
 
     if (reader.hasError())
@@ -93,6 +148,13 @@ void RealmWorksStructure::loadFile(QIODevice *device)
     RWStructureItem *main_structure = export_element->findChild<RWStructure*>(QString(), Qt::FindDirectChildrenOnly);
     categories = main_structure->findChildren<RWCategory*>();   // not simply childItems, since some might be sub-categories
     domains = main_structure->childItems<RWDomain*>();
+    domains_by_id.clear();
+    domains_by_name.clear();
+    for (auto domain: domains)
+    {
+        domains_by_id.insert(domain->id(), domain);
+        domains_by_name.insert(domain->name(), domain);
+    }
     //qDebug() << "File has" << categories.count() << "categories and" << domains.count() << "domains";
 }
 
@@ -178,18 +240,631 @@ RWStructureItem *RealmWorksStructure::read_element(QXmlStreamReader *reader, RWS
  * @param model
  */
 
-void RealmWorksStructure::writeExportFile(QIODevice *device,
+namespace {
+
+// Number of consecutive rows rendered as a single XML fragment
+const int ROWS_PER_BLOCK = 64;
+
+// Number of digits reserved in the export header for content_summary/@topic_count
+const int TOPIC_COUNT_WIDTH = 10;
+
+const qint64 COPY_CHUNK_SIZE = 1024 * 1024;
+
+// Allowance for the XML elements of each topic when estimating the size of a sharded export
+const qint64 TOPIC_OVERHEAD_BYTES = 1024;
+
+// Minimum time between exportProgress signals (about 30 updates per second)
+const qint64 PROGRESS_INTERVAL_MS = 33;
+
+struct RenderBlock
+{
+    const RWTopic *topic;
+    const QAbstractItemModel *model;
+    QVector<int> rows;
+    ExportContext ctx;
+    ExportLog *log;         // where any other messages from the rendering thread should go
+};
+
+struct RenderedBlock
+{
+    QByteArray xml;
+    QVector<ExportContext::DeferredAsset> assets;
+    RWTopic::GeneratedTopics topics;
+    int topic_count{0};
+    int row_count{0};
+};
+
+/**
+ * @brief The RenderBlockFunctor struct
+ * Renders a block of rows into a self-contained XML fragment (in UTF-8, the encoding of the export file).
+ * The check for duplicate topics is left to the caller, so that it can be done in row order.
+ */
+struct RenderBlockFunctor
+{
+    typedef RenderedBlock result_type;
+    RenderedBlock operator()(const RenderBlock &block) const
+    {
+        ExportLog::Scope log_scope(block.log);
+        RenderedBlock result;
+        // Large assets are left out of the fragment, and are written when it is copied to the output file.
+        const ExportContext ctx = block.ctx.withDeferredAssets(&result.assets);
+        QXmlStreamWriter writer(&result.xml);
+        writer.setAutoFormatting(true);
+        for (int row : block.rows)
+        {
+            if (block.topic->writeToContents(&writer, ctx, block.model->index(row, 0), true, &result.topics))
+                result.topic_count++;
+        }
+        result.row_count = block.rows.size();
+        return result;
+    }
+};
+
+/**
+ * @brief The RowSizeFunctor struct
+ * Estimates the number of bytes which the topic for a row will occupy in the export file.
+ */
+struct RowSizeFunctor
+{
+    typedef qint64 result_type;
+    const QAbstractItemModel *model;
+    QVector<int> asset_columns;
+    const RealmWorksStructure *structure;
+    qint64 operator()(int row) const
+    {
+        qint64 result = TOPIC_OVERHEAD_BYTES;
+        const int columns = model->columnCount();
+        for (int column = 0; column < columns; column++)
+            result += model->index(row, column).data().toString().size();
+        // Assets are embedded as base64
+        for (int column : asset_columns)
+        {
+            QFileInfo info(structure->assetPath(model->index(row, column).data().toString()));
+            if (info.isFile()) result += (info.size() + 2) / 3 * 4;
+        }
+        return result;
+    }
+};
+
+/**
+ * @brief batchAssets
+ * @param model
+ * @param blocks
+ * @param asset_columns the columns containing asset file names (see IncrementalState::assetColumns)
+ * @return the full path of each distinct asset file named by the rows of the blocks, in row order.
+ */
+QStringList batchAssets(const QAbstractItemModel *model, const QVector<RenderBlock> &blocks, const QVector<int> &asset_columns)
+{
+    QStringList result;
+    QSet<QString> seen;
+    for (const RenderBlock &block : blocks)
+        for (int row : block.rows)
+            for (int column : asset_columns)
+            {
+                const QVariant value = model->index(row, column).data();
+                if (value.type() != QVariant::String || value.toString().isEmpty()) continue;
+                const QString path = block.ctx.assetPath(value.toString());
+                if (!seen.contains(path))
+                {
+                    seen.insert(path);
+                    result.append(path);
+                }
+            }
+    return result;
+}
+
+/**
+ * @brief The RowHashFunctor struct
+ * Calculates the content hash of a row for an incremental export.
+ */
+struct RowHashFunctor
+{
+    typedef QByteArray result_type;
+    const QAbstractItemModel *model;
+    QVector<int> asset_columns;
+    const RealmWorksStructure *structure;
+    QByteArray operator()(int row) const
+    {
+        return IncrementalState::rowHash(model, row, asset_columns, structure);
+    }
+};
+
+}
+
+/**
+ * @brief RealmWorksStructure::cancelExport
+ * Request that the export currently running in writeExportFile stops as soon as possible.
+ * This may be called from any thread.
+ */
+void RealmWorksStructure::cancelExport()
+{
+    export_cancelled.storeRelease(1);
+}
+
+/**
+ * @brief RealmWorksStructure::clearCancel
+ * Clears the cancellation of a previous export. This must be called before the new export is started
+ * (rather than by the export itself), so that a cancel requested before the export gets going isn't lost.
+ */
+void RealmWorksStructure::clearCancel()
+{
+    export_cancelled.storeRelease(0);
+}
+
+/**
+ * @brief RealmWorksStructure::reportProgress
+ * Emits exportProgress, but no more often than every PROGRESS_INTERVAL_MS (unless forced),
+ * so that the receiver isn't flooded with signals.
+ */
+void RealmWorksStructure::reportProgress(bool force)
+{
+    // (Several files of a sharded export may be written at the same time)
+    QMutexLocker lock(&progress_mutex);
+    if (force || !progress_timer.isValid() || progress_timer.elapsed() >= PROGRESS_INTERVAL_MS)
+    {
+        emit exportProgress(progress_value.loadAcquire(), progress_maximum, progress_label);
+        progress_timer.start();
+    }
+}
+
+void RealmWorksStructure::setProgressLabel(const QString &label)
+{
+    QMutexLocker lock(&progress_mutex);
+    progress_label = label;
+}
+
+/**
+ * @brief RealmWorksStructure::startExport
+ * Resets the progress for a new export (the cancellation flag is left alone, see clearCancel).
+ */
+void RealmWorksStructure::startExport()
+{
+    progress_timer.invalidate();
+    progress_value.storeRelease(0);
+    progress_maximum = 0;
+    setProgressLabel(tr("Generating topics/articles..."));
+    reportProgress(/*force*/ true);
+}
+
+/**
+ * @brief RealmWorksStructure::reportMessages
+ * Reports the problems found while generating the export (on this thread, in the order they were found).
+ */
+void RealmWorksStructure::reportMessages(const ExportContext &ctx)
+{
+    for (const QString &message : ctx.messages())
+        qWarning().noquote() << message;
+}
+
+/**
+ * @brief RealmWorksStructure::writeExportFile
+ * Generates the complete RWEXPORT file. This doesn't use any GUI elements,
+ * so it can be run on a worker thread (progress is reported via the exportProgress signal).
+ * @param device
+ * @param body_topics
+ * @param model
+ * @param incremental if not null, then topics are given stable IDs, and only those which have changed
+ * since the export described by this state are written (the state is updated with the current hashes).
+ * @return false if the export was cancelled (or failed), in which case the output is incomplete
+ */
+bool RealmWorksStructure::writeExportFile(QIODevice *device,
                                           const QList<RWTopic*> &body_topics,
-                                          const QAbstractItemModel *model)
+                                          const QAbstractItemModel *model,
+                                          IncrementalState *incremental)
+{
+    // The topic count is patched into the header once all the topics have been written,
+    // which requires a seekable device; so use a temporary file for anything else.
+    if (device->isSequential())
+    {
+        QTemporaryFile temp;
+        if (!temp.open())
+        {
+            qWarning() << "Failed to create temporary file for export:" << temp.errorString();
+            return false;
+        }
+        if (!writeExportFile(&temp, body_topics, model, incremental)) return false;
+        temp.seek(0);
+        while (!temp.atEnd())
+            device->write(temp.read(COPY_CHUNK_SIZE));
+        return true;
+    }
+
+    startExport();
+
+    // Everything which is specific to this export
+    // (topic ids which don't come from the rows of the model start after the last row)
+    ExportContext ctx(this, model->rowCount() + 10);
+    const QVector<ExportUnit> units = planExport(ctx, body_topics, model, incremental);
+
+    bool result = writeShard(device, ctx, model, units);
+    reportProgress(/*force*/ true);
+    reportMessages(ctx);
+    return result;
+}
+
+/**
+ * @brief RealmWorksStructure::writeShardedExport
+ * Generates the export as several RWEXPORT files, each of which contains at most limits.max_topics body topics
+ * and roughly limits.max_bytes bytes. Every file contains the complete structure and its own content_summary,
+ * and all the topics beneath a top-level parent topic are kept in the same file
+ * (so a single group may exceed the limits).
+ *
+ * The size of each topic is estimated from its data and asset files, so that the files can be planned
+ * in advance and then written concurrently.
+ * @param filename the name of the export; the files are called <name>_001.rwexport, <name>_002.rwexport, ...
+ * @param body_topics
+ * @param model
+ * @param limits
+ * @param incremental (see writeExportFile)
+ * @param files if not null, receives the names of the files which were written
+ * @return false if the export was cancelled, or any of the files couldn't be written
+ * (the files which were completed are left in place)
+ */
+bool RealmWorksStructure::writeShardedExport(const QString &filename,
+                                             const QList<RWTopic*> &body_topics,
+                                             const QAbstractItemModel *model,
+                                             const ShardLimits &limits,
+                                             IncrementalState *incremental,
+                                             QStringList *files)
+{
+    startExport();
+
+    ExportContext ctx(this, model->rowCount() + 10);
+    const QVector<ExportUnit> units = planExport(ctx, body_topics, model, incremental);
+
+    // Estimated size of the topic for each row (only needed when limiting the size of each file)
+    QVector<qint64> row_bytes(model->rowCount(), 0);
+    if (limits.max_bytes > 0)
+    {
+        setProgressLabel(tr("Estimating size of topics..."));
+        reportProgress(/*force*/ true);
+        for (const ExportUnit &unit : units)
+        {
+            const QVector<qint64> sizes = QtConcurrent::blockingMapped<QVector<qint64>>(unit.rows,
+                    RowSizeFunctor{model, IncrementalState::assetColumns(unit.topic, model->columnCount()), this});
+            for (int i = 0; i < unit.rows.size(); i++)
+                row_bytes[unit.rows.at(i)] += sizes.at(i);
+        }
+    }
+
+    // Fill each file in turn, in the order in which the topics would appear in a single file.
+    struct ShardPlan
+    {
+        QVector<ExportUnit> units;
+        int topics{0};
+        qint64 bytes{0};
+    };
+    QVector<ShardPlan> shards(1);
+    auto fits = [&limits](const ShardPlan &plan, int topics, qint64 bytes) {
+        return plan.units.isEmpty() ||
+                ((limits.max_topics <= 0 || plan.topics + topics <= limits.max_topics) &&
+                 (limits.max_bytes  <= 0 || plan.bytes  + bytes  <= limits.max_bytes));
+    };
+    auto add = [&shards](const RWTopic *topic, const QVector<int> &rows, qint64 bytes) {
+        ShardPlan &plan = shards.last();
+        if (!plan.units.isEmpty() && plan.units.last().topic == topic)
+            plan.units.last().rows += rows;
+        else
+            plan.units.append(ExportUnit{topic, rows});
+        plan.topics += rows.size();
+        plan.bytes  += bytes;
+    };
+    for (const ExportUnit &unit : units)
+    {
+        if (unit.topic->parents.isEmpty())
+        {
+            // Topics without a parent can go into any file.
+            for (int row : unit.rows)
+            {
+                if (!fits(shards.last(), 1, row_bytes.at(row))) shards.append(ShardPlan());
+                add(unit.topic, QVector<int>{row}, row_bytes.at(row));
+            }
+        }
+        else
+        {
+            for (const QVector<int> &group : parentGroups(unit.topic->parents.first(), model, unit.rows))
+            {
+                qint64 bytes = 0;
+                for (int row : group) bytes += row_bytes.at(row);
+                if (!fits(shards.last(), group.size(), bytes)) shards.append(ShardPlan());
+                add(unit.topic, group, bytes);
+            }
+        }
+    }
+
+    // Connections to topics in another file can't be written, so each file needs to know where every topic is.
+    QVector<int> row_shards(model->rowCount(), -1);
+    for (int shard = 0; shard < shards.size(); shard++)
+        for (const ExportUnit &unit : shards.at(shard).units)
+            for (int row : unit.rows)
+                if (row_shards.at(row) < 0) row_shards[row] = shard;
+    ctx.setRowShards(row_shards);
+
+    QFileInfo info(filename);
+    QStringList names;
+    for (int shard = 0; shard < shards.size(); shard++)
+        names.append(info.absoluteDir().absoluteFilePath(QString("%1_%2.%3").arg(info.completeBaseName())
+                                                         .arg(shard + 1, 3, 10, QChar('0'))
+                                                         .arg(info.suffix().isEmpty() ? QString("rwexport") : info.suffix())));
+
+    // Each file also renders its topics on the global thread pool, so only write a few files at once.
+    setProgressLabel(tr("Generating %1 files...").arg(shards.size()));
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() / 2));
+    QList<QFuture<bool>> futures;
+    ExportLog *log = ExportLog::current();
+    for (int shard = 0; shard < shards.size(); shard++)
+    {
+        const ExportContext shard_ctx = ctx.forShard(shard);
+        const QString name = names.at(shard);
+        const QVector<ExportUnit> shard_units = shards.at(shard).units;
+        futures.append(QtConcurrent::run(&pool, [this, log, name, shard_ctx, model, shard_units]() {
+            ExportLog::Scope log_scope(log);
+            return writeShardFile(name, shard_ctx, model, shard_units);
+        }));
+    }
+
+    bool result = true;
+    for (int shard = 0; shard < futures.size(); shard++)
+    {
+        if (futures[shard].result())
+        {
+            if (files) files->append(names.at(shard));
+        }
+        else
+            result = false;
+    }
+    reportProgress(/*force*/ true);
+    reportMessages(ctx);
+    return result;
+}
+
+/**
+ * @brief RealmWorksStructure::writeShardFile
+ * Writes one of the files of a sharded export. The file only appears once it is complete.
+ * @return false if the export was cancelled, or the file couldn't be written
+ */
+bool RealmWorksStructure::writeShardFile(const QString &filename, const ExportContext &ctx,
+                                         const QAbstractItemModel *model, const QVector<ExportUnit> &units)
+{
+    QSaveFile file(filename);
+    if (!file.open(QFile::WriteOnly))
+    {
+        ctx.addMessage(tr("Failed to create file %1").arg(filename));
+        return false;
+    }
+    if (!writeShard(&file, ctx, model, units))
+    {
+        file.cancelWriting();
+        return false;
+    }
+    if (ctx.omittedConnections() > 0)
+        ctx.addMessage(tr("%1: %2 connections to topics in other files were not written")
+                       .arg(QFileInfo(filename).fileName()).arg(ctx.omittedConnections()));
+    if (!file.commit())
+    {
+        ctx.addMessage(tr("Failed to write file %1").arg(filename));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief RealmWorksStructure::exportRows
+ * Finds the rows of the model which are used by each body topic (also used by ExportValidator).
+ * @param body_topics
+ * @param model
+ * @return the rows for each body topic which generates anything from the data (in the order in which they are written)
+ */
+QVector<RealmWorksStructure::ExportUnit> RealmWorksStructure::exportRows(const QList<RWTopic*> &body_topics,
+                                                                         const QAbstractItemModel *model) const
+{
+    // Only topics with a name column generate anything from the data
+    QList<RWTopic*> generating_topics;
+    for (auto topic: body_topics)
+    {
+        if (topic->publicName().namefield().modelColumn() >= 0)
+            generating_topics.append(topic);
+    }
+
+    // Make one pass over the model, sending each row to every topic whose key it matches.
+    // (Each key column is only read once per row, no matter how many topics use it.)
+    QVector<int> key_columns;
+    QVector<int> topic_key_slot;
+    for (auto topic: generating_topics)
+    {
+        int slot = -1;
+        if (topic->keyColumn() >= 0)
+        {
+            slot = key_columns.indexOf(topic->keyColumn());
+            if (slot < 0)
+            {
+                slot = key_columns.size();
+                key_columns.append(topic->keyColumn());
+            }
+        }
+        topic_key_slot.append(slot);
+    }
+    QVector<QString> key_values;
+    for (auto topic: generating_topics) key_values.append(topic->keyValue());
+
+    QVector<QVector<int>> topic_rows(generating_topics.size());
+    QVector<QString> row_keys(key_columns.size());
+    const int maxrow = model->rowCount();
+    for (int row = 0; row < maxrow; row++)
+    {
+        for (int slot = 0; slot < key_columns.size(); slot++)
+            row_keys[slot] = model->index(row, key_columns.at(slot)).data().toString();
+
+        for (int t = 0; t < generating_topics.size(); t++)
+        {
+            int slot = topic_key_slot.at(t);
+            if (slot < 0 || row_keys.at(slot) == key_values.at(t))
+                topic_rows[t].append(row);
+        }
+    }
+
+    QVector<ExportUnit> units;
+    for (int t = 0; t < generating_topics.size(); t++)
+        units.append(ExportUnit{generating_topics.at(t), topic_rows.at(t)});
+    return units;
+}
+
+/**
+ * @brief row_content_suffix
+ * @return a suffix which distinguishes the row from other rows with the same topic name,
+ * which only depends on the contents of the row (not on its position in the model).
+ */
+static QString row_content_suffix(const QAbstractItemModel *model, int row)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    const int columns = model->columnCount();
+    for (int column = 0; column < columns; column++)
+    {
+        hash.addData(model->index(row, column).data().toString().toUtf8());
+        hash.addData("\x1f", 1);
+    }
+    return hash.result().toHex().left(12);
+}
+
+/**
+ * @brief RealmWorksStructure::stableTopicIds
+ * Topic IDs are derived from the category and name of each topic,
+ * so that they are the same in every export (regardless of the position of the row).
+ * Rows which share a category and name are told apart by their contents, so that adding or removing
+ * one of them doesn't change the IDs of the others (although changing such a row changes its ID).
+ * @param units the rows for each body topic (see exportRows)
+ * @param model
+ * @return the topic ID for each row of the model, for ExportContext::setStableTopicIds
+ * (a row used by more than one topic gets the ID from the first of them).
+ */
+QVector<QString> RealmWorksStructure::stableTopicIds(const QVector<ExportUnit> &units, const QAbstractItemModel *model)
+{
+    QVector<QString> row_ids(model->rowCount());
+    QHash<QString,int> name_count;
+    for (const ExportUnit &unit : units)
+    {
+        const RWTopic *topic = unit.topic;
+        for (int row : unit.rows)
+        {
+            if (!row_ids.at(row).isEmpty()) continue;
+            row_ids[row] = ExportContext::stableTopicId(topic->category->id() + '/' +
+                                                        topic->publicName().namefield().valueString(model->index(row, 0)));
+            name_count[row_ids.at(row)]++;
+        }
+    }
+
+    // Only rows with identical contents are numbered in the order in which they appear (they can't be told apart).
+    QHash<QString,int> id_count;
+    for (int row = 0; row < row_ids.size(); row++)
+    {
+        if (name_count.value(row_ids.at(row)) < 2) continue;
+        const QString id = row_ids.at(row) + '_' + row_content_suffix(model, row);
+        int count = id_count[id]++;
+        row_ids[row] = (count == 0) ? id : QString("%1_%2").arg(id).arg(count);
+    }
+    return row_ids;
+}
+
+/**
+ * @brief RealmWorksStructure::planExport
+ * Decides which rows of the model are put into the export for each body topic.
+ * @param ctx
+ * @param body_topics
+ * @param model
+ * @param incremental if not null, then only the rows which have changed are included (see writeExportFile)
+ * @return the rows for each body topic which generates anything from the data (in the order in which they are written)
+ */
+QVector<RealmWorksStructure::ExportUnit> RealmWorksStructure::planExport(ExportContext &ctx,
+                                                                         const QList<RWTopic*> &body_topics,
+                                                                         const QAbstractItemModel *model,
+                                                                         IncrementalState *incremental)
+{
+    QVector<ExportUnit> units = exportRows(body_topics, model);
+
+    if (incremental)
+    {
+        const QVector<QString> row_ids = stableTopicIds(units, model);
+        ctx.setStableTopicIds(row_ids);
+
+        // Only keep the rows which have changed since the previous export
+        setProgressLabel(tr("Checking for changes..."));
+        reportProgress(/*force*/ true);
+        for (ExportUnit &unit : units)
+        {
+            const RWTopic *topic = unit.topic;
+            const QVector<int> asset_columns = IncrementalState::assetColumns(topic, model->columnCount());
+            const QVector<int> &rows = unit.rows;
+            // Reading every column of every row is the slow part, so share it out.
+            const QVector<QByteArray> hashes =
+                    QtConcurrent::blockingMapped<QVector<QByteArray>>(rows, RowHashFunctor{model, asset_columns, this});
+
+            QVector<int> changed_rows;
+            for (int i = 0; i < rows.size(); i++)
+            {
+                if (incremental->rowChanged(row_ids.at(rows.at(i)) + '/' + topic->category->id(), hashes.at(i)))
+                    changed_rows.append(rows.at(i));
+            }
+            unit.rows = changed_rows;
+        }
+        setProgressLabel(tr("Generating topics/articles..."));
+    }
+
+    // Progress is across all the topics to be generated
+    for (const ExportUnit &unit : units)
+        progress_maximum += unit.rows.size();
+
+    fetchUrlAssets(ctx, model, units);
+    return units;
+}
+
+/**
+ * @brief RealmWorksStructure::fetchUrlAssets
+ * Downloads all the assets which are given as URLs by the rows to be exported,
+ * so that generating the topics doesn't have to wait for each one in turn.
+ * @param ctx
+ * @param model
+ * @param units
+ */
+void RealmWorksStructure::fetchUrlAssets(const ExportContext &ctx, const QAbstractItemModel *model,
+                                         const QVector<ExportUnit> &units)
 {
-    QProgressDialog progress;
-    progress.setModal(true);
-    progress.setWindowTitle("Progress");
-    progress.setLabelText("Generating topics/articles...");
-    progress.setCancelButton(nullptr);  // hide cancel button
-    progress.show();
+    QList<QUrl> urls;
+    for (const ExportUnit &unit : units)
+    {
+        const QVector<int> asset_columns = IncrementalState::assetColumns(unit.topic, model->columnCount());
+        for (int row : unit.rows)
+            for (int column : asset_columns)
+            {
+                const QString value = model->index(row, column).data().toString();
+                if (value.isEmpty() || QFileInfo(ctx.assetPath(value)).isFile()) continue;
+                const QUrl url(value);
+                if (UrlAssetFetcher::isRemote(url)) urls.append(url);
+            }
+    }
+    if (urls.isEmpty()) return;
 
-    RWTopic::initBeforeExport(model->rowCount());
+    setProgressLabel(tr("Fetching URLs..."));
+    reportProgress(/*force*/ true);
+    const int cache_hits = ctx.urlAssets().fetch(urls);
+    qInfo().noquote() << tr("Fetched URL assets (%1 from the disk cache)").arg(cache_hits);
+    setProgressLabel(tr("Generating topics/articles..."));
+}
+
+/**
+ * @brief RealmWorksStructure::writeShard
+ * Writes a complete RWEXPORT file containing the topics for the given rows.
+ * @param device a seekable device
+ * @param ctx
+ * @param model
+ * @param units the rows to be written for each body topic
+ * @return false if the export was cancelled or failed (or the header couldn't be updated)
+ */
+bool RealmWorksStructure::writeShard(QIODevice *device, const ExportContext &ctx,
+                                     const QAbstractItemModel *model, const QVector<ExportUnit> &units)
+{
+    qint64 topic_count_pos = 0;
+    int topic_count = 0;
 
     QXmlStreamWriter *writer = new QXmlStreamWriter(device);
     // Write out the basics to the file.
@@ -232,23 +907,11 @@ void RealmWorksStructure::writeExportFile(QIODevice *device,
                 writer->writeAttribute("max_category_count", QString::number(categories.count()));
                 writer->writeAttribute("plot_count", "0");
 
-                // Get count of number of topics which will be generated
-                int topic_count = 0;
-                for (auto topic: body_topics)
-                {
-                    if (topic->publicName().namefield().modelColumn() >= 0)
-                    {
-                        if (topic->keyColumn() < 0)
-                            topic_count += model->rowCount(); // all entries will be added
-                        else
-                            topic_count += model->match(/*start*/ model->index(0,topic->keyColumn()),
-                                                  /*role*/  Qt::DisplayRole,
-                                                  /*value*/ topic->keyValue(),
-                                                  /*hits*/  -1,
-                                                  /*match*/ Qt::MatchFixedString|Qt::MatchCaseSensitive).size();
-                    }
-                }
-                writer->writeAttribute("topic_count", QString::number(topic_count));
+                // The number of topics isn't known until they have all been written,
+                // so write a fixed width placeholder which is replaced at the end.
+                writer->writeAttribute("topic_count", QString(TOPIC_COUNT_WIDTH, '0'));
+                // (The attribute has been written in full, including its closing quote)
+                topic_count_pos = device->pos() - TOPIC_COUNT_WIDTH - 1;
             }
             writer->writeEndElement();  // content_summary
         }
@@ -260,28 +923,8 @@ void RealmWorksStructure::writeExportFile(QIODevice *device,
         // Process the source data to write out the entire RWEXPORT file.
         writer->writeStartElement("contents");
 
-        // Progress is across all rows of the base model
-        progress.setMaximum(model->rowCount());
-
-        for (auto topic: body_topics)
-        {
-            if (topic->publicName().namefield().modelColumn() >= 0)
-            {
-                if (topic->keyColumn() >= 0)
-                {
-                    QSortFilterProxyModel proxy;
-                    proxy.setSourceModel(const_cast<QAbstractItemModel*>(model));
-                    proxy.setFilterKeyColumn(topic->keyColumn());
-                    // TODO: need to ignore all possible "regexp" special characters from topic->keyValue
-                    proxy.setFilterRegExp('^' + QRegExp::escape(topic->keyValue()) + '$');
-                    writeParentToStructure(progress, writer, topic, &proxy, topic->parents);
-                }
-                else
-                {
-                    writeParentToStructure(progress, writer, topic, model, topic->parents);
-                }
-            }
-        }
+        for (const ExportUnit &unit : units)
+            topic_count += writeParentToStructure(writer, ctx, unit.topic, model, unit.rows, unit.topic->parents);
 
         writer->writeEndElement(); // contents
     }
@@ -289,6 +932,23 @@ void RealmWorksStructure::writeExportFile(QIODevice *device,
 
     writer->writeEndDocument();
     delete writer;
+
+    // The file is incomplete (or has a corrupt asset), so there is no point in updating the header.
+    if (export_cancelled.loadAcquire() || ctx.hasFailed()) return false;
+
+    // Now put the real topic count into the header (leading zeroes keep it the same width)
+    qint64 end_pos = device->pos();
+    if (device->seek(topic_count_pos))
+    {
+        device->write(QString("%1").arg(topic_count, TOPIC_COUNT_WIDTH, 10, QChar('0')).toLatin1());
+        device->seek(end_pos);
+    }
+    else
+    {
+        qWarning() << "Failed to update the topic count in the export file";
+        return false;
+    }
+    return true;
 }
 
 void RealmWorksStructure::saveState(QDataStream &stream)
@@ -304,9 +964,17 @@ void RealmWorksStructure::saveState(QDataStream &stream)
     stream << details_credits;
     stream << details_legal;
     stream << details_other_notes;
+    stream << image_max_dimension;
+    stream << image_quality;
 }
 
-void RealmWorksStructure::loadState(QDataStream &stream)
+/**
+ * @brief RealmWorksStructure::loadState
+ * Reads what saveState writes.
+ * @param stream
+ * @param save_version the version of the project file being read (see ProjectFile)
+ */
+void RealmWorksStructure::loadState(QDataStream &stream, int save_version)
 {
     //qDebug() << "RealmWorksStructure::loadState";
     // Load DETAILS
@@ -319,80 +987,152 @@ void RealmWorksStructure::loadState(QDataStream &stream)
     stream >> details_credits;
     stream >> details_legal;
     stream >> details_other_notes;
+    if (save_version >= 0x0216)
+    {
+        stream >> image_max_dimension;
+        stream >> image_quality;
+    }
 }
 
 /**
  * @brief RealmWorksStructure::writeParentToStructure
  * Write out the parent topics, with the subject topics as children of the appropriate lowest parent.
  *
- * @param progress
  * @param writer
+ * @param ctx the export being generated
  * @param topic_category
  * @param model
+ * @param rows the rows of the model to be written beneath this parent (in the order in which they should appear)
  * @param parent_category
+ * @return the number of body topics written
  */
-void RealmWorksStructure::writeParentToStructure(QProgressDialog &progress,
-                                                 QXmlStreamWriter *writer,
+int RealmWorksStructure::writeParentToStructure(QXmlStreamWriter *writer,
+                                                 const ExportContext &ctx,
                                                  const RWTopic* body_topic,
                                                  const QAbstractItemModel *model,
+                                                 const QVector<int> &rows,
                                                  const QList<RWTopic*> &parent_topics)
 {
+    int topic_count = 0;
+    if (export_cancelled.loadAcquire()) return topic_count;
+
     if (parent_topics.isEmpty())
     {
-        // No parent topic - so write out the table as individual topics
-        int maxrow = model->rowCount();
-        progress.setLabelText(body_topic->structure->name());
-        for (int row = 0 ; row < maxrow ; row++)
+        // No parent topic - so write out the table as individual topics.
+        // Blocks of rows are rendered concurrently, and then put into the file in row order.
+        setProgressLabel(body_topic->structure->name());
+
+        QVector<RenderBlock> blocks;
+        for (int first = 0; first < rows.size(); first += ROWS_PER_BLOCK)
+            blocks.append(RenderBlock{body_topic, model, rows.mid(first, ROWS_PER_BLOCK), ctx, ExportLog::current()});
+
+        // Limit the number of rendered blocks held in memory at once
+        const int batch_size = qMax(1, QThread::idealThreadCount() * 4);
+
+        // The asset files for each batch are read while the previous batch is being rendered and written
+        // (pictures are first replaced by their smaller copies, if the size of images is limited).
+        // Each call has its own prefetcher, since the files of a sharded export are written at the same time;
+        // anything still waiting when this returns is dropped.
+        AssetCache::Prefetcher prefetcher(&ctx.assetCache());
+        QVector<int> picture_columns;
+        const QVector<int> asset_columns = IncrementalState::assetColumns(body_topic, model->columnCount(),
+                                                                          image_max_dimension > 0 ? &picture_columns : nullptr);
+        for (int batch = 0; batch < blocks.size() && !export_cancelled.loadAcquire() && !ctx.hasFailed(); batch += batch_size)
         {
-            progress.setValue(row);
-            qApp->processEvents();  // for progress dialog
+            if (!asset_columns.isEmpty() && batch + batch_size < blocks.size())
+            {
+                const QVector<RenderBlock> next_batch = blocks.mid(batch + batch_size, batch_size);
+                const QStringList picture_list = batchAssets(model, next_batch, picture_columns);
+                const QSet<QString> pictures(picture_list.begin(), picture_list.end());
+                auto resolve = [ctx, pictures](const QString &filename) {
+                    return pictures.contains(filename) ? ctx.pictureFile(filename) : filename;
+                };
+                prefetcher.prefetch(batchAssets(model, next_batch, asset_columns), resolve);
+            }
+
+            const QVector<RenderedBlock> rendered =
+                    QtConcurrent::blockingMapped<QVector<RenderedBlock>>(blocks.mid(batch, batch_size), RenderBlockFunctor());
 
-            body_topic->writeToContents(writer, model->index(row, 0), true);
+            // Ensure that any pending start tag in the main writer is closed before inserting the fragments.
+            writer->writeCharacters(QString());
+            for (const RenderedBlock &block : rendered)
+            {
+                for (auto &topic : block.topics)
+                    ctx.checkGeneratedTopic(topic.first, topic.second);
+                qint64 done = 0;
+                for (auto &asset : block.assets)
+                {
+                    writer->device()->write(block.xml.constData() + done, asset.offset - done);
+                    // The start of the asset has already been written, so the output is now unusable
+                    if (!ctx.assetCache().write(asset.filename, writer->device()))
+                        ctx.fail(tr("Failed to read file: %1").arg(asset.filename));
+                    done = asset.offset;
+                }
+                writer->device()->write(block.xml.constData() + done, block.xml.size() - done);
+                topic_count += block.topic_count;
+                progress_value.fetchAndAddRelaxed(block.row_count);
+            }
+            reportProgress();
         }
+        if (export_cancelled.loadAcquire() || ctx.hasFailed()) prefetcher.cancel();
     }
     else if (parent_topics.first()->publicName().namefield().modelColumn() < 0)
     {
         // The parent has a FIXED STRING
-        parent_topics.first()->writeStartToContents(writer, model->index(0,0), false);
+        parent_topics.first()->writeStartToContents(writer, ctx, rows.isEmpty() ? QModelIndex() : model->index(rows.first(), 0), false);
         // Maybe more children to write
-        writeParentToStructure(progress, writer, body_topic, model, parent_topics.mid(1));
+        topic_count = writeParentToStructure(writer, ctx, body_topic, model, rows, parent_topics.mid(1));
         writer->writeEndElement();
     }
     else
     {
-        // The parent identifies a COLUMN to use to generate a parent for each unique entry
-        // in that column.
-        QSet<QString> parent_set;
-        int parent_column = parent_topics.first()->publicName().namefield().modelColumn();
-        for (int row=0; row<model->rowCount(); row++)
+        // The parent identifies a COLUMN to use to generate a parent for each unique entry in that column.
+        for (auto &children: parentGroups(parent_topics.first(), model, rows))
         {
-            QString name = model->index(row, parent_column).data().toString();
-            if (name.isEmpty())
-            {
-                qDebug() << "row" << row << "has no name";
-            }
-            parent_set.insert(name);
+            if (export_cancelled.loadAcquire()) break;
+            parent_topics.first()->writeStartToContents(writer, ctx, model->index(children.first(), 0), false);
+            topic_count += writeParentToStructure(writer, ctx, body_topic, model, children, parent_topics.mid(1));
+            writer->writeEndElement();
         }
-        // Always put the parents in a predictable (i.e. alphabetical) order
-        QList<QString> parent_names = parent_set.toList();
-        std::sort(parent_names.begin(), parent_names.end());
+    }
+    return topic_count;
+}
 
-        QSortFilterProxyModel proxy;
-        proxy.setSourceModel(const_cast<QAbstractItemModel*>(model));
-        proxy.setFilterKeyColumn(parent_column);
+/**
+ * @brief RealmWorksStructure::parentGroups
+ * @param parent the top-most parent of the body topic
+ * @param model
+ * @param rows
+ * @return the rows which appear beneath each instance of the parent topic,
+ * in the order in which the parent topics are written.
+ */
+QVector<QVector<int>> RealmWorksStructure::parentGroups(const RWTopic *parent,
+                                                       const QAbstractItemModel *model,
+                                                       const QVector<int> &rows)
+{
+    // A parent with a FIXED STRING contains all the rows
+    int parent_column = parent->publicName().namefield().modelColumn();
+    if (parent_column < 0) return QVector<QVector<int>>{rows};
 
-        // TODO - iterate across unique values in the column
-        for (auto name: parent_names)
+    // Group the rows by the value in the parent's column in a single pass.
+    QHash<QString,QVector<int>> parent_rows;
+    for (int row : rows)
+    {
+        QString name = model->index(row, parent_column).data().toString();
+        if (name.isEmpty())
         {
-            // Find the rows which match the parent's name
-            // (ignore regexp characters in the name)
-            proxy.setFilterRegExp('^' + QRegExp::escape(name) + '$');
-
-            parent_topics.first()->writeStartToContents(writer, proxy.index(0,0), false);
-            writeParentToStructure(progress, writer, body_topic, &proxy, parent_topics.mid(1));
-            writer->writeEndElement();
+            qDebug() << "row" << row << "has no name";
         }
+        parent_rows[name].append(row);
     }
+    // Always put the parents in a predictable (i.e. alphabetical) order
+    QList<QString> parent_names = parent_rows.keys();
+    std::sort(parent_names.begin(), parent_names.end());
+
+    QVector<QVector<int>> result;
+    for (auto name: parent_names)
+        result.append(parent_rows.value(name));
+    return result;
 }
 
 
@@ -23,6 +23,11 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <QDataStream>
 #include <QXmlStreamReader>
 #include <QAbstractItemModel>
+#include <QVector>
+#include <QHash>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QElapsedTimer>
 
 #include "rw_domain.h"
 #include "rw_category.h"
@@ -30,8 +35,10 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "rw_partition.h"
 #include "rw_structure.h"
 
-class QProgressDialog;
 class QDataStream;
+class ExportContext;
+class IncrementalState;
+class UrlAssetFetcher;
 
 class RealmWorksStructure : public QObject
 {
@@ -39,18 +46,52 @@ class RealmWorksStructure : public QObject
 
 public:
     explicit RealmWorksStructure(QObject *parent = nullptr);
+    ~RealmWorksStructure() override;
 
 public Q_SLOTS:
     void loadFile(QIODevice*);
-    void writeExportFile(QIODevice*,
+    bool writeExportFile(QIODevice*,
                          const QList<RWTopic*> &body_topics,
-                         const QAbstractItemModel *model);
+                         const QAbstractItemModel *model,
+                         IncrementalState *incremental = nullptr);
+    void cancelExport();
+    void clearCancel();
 
     void saveState(QDataStream&);
-    void loadState(QDataStream&);
+    void loadState(QDataStream&, int save_version);
 
 public:
+    // Limits on the size of each file of a sharded export (zero for no limit)
+    struct ShardLimits
+    {
+        int max_topics{0};
+        qint64 max_bytes{0};
+    };
+    bool writeShardedExport(const QString &filename,
+                            const QList<RWTopic*> &body_topics,
+                            const QAbstractItemModel *model,
+                            const ShardLimits &limits,
+                            IncrementalState *incremental = nullptr,
+                            QStringList *files = nullptr);
+
+    // The rows of the model to be written for one body topic
+    struct ExportUnit
+    {
+        const RWTopic *topic;
+        QVector<int> rows;
+    };
+    QVector<ExportUnit> exportRows(const QList<RWTopic*> &body_topics, const QAbstractItemModel *model) const;
+    static QVector<QString> stableTopicIds(const QVector<ExportUnit> &units, const QAbstractItemModel *model);
+
     static RealmWorksStructure *theInstance();
+    static RealmWorksStructure *owner(const QObject *item);
+
+    // Directory for relative file names of assets (if empty, the current directory is used)
+    QString data_directory;
+    QString assetPath(const QString &filename) const;
+
+    RWDomain *domainById(const QString &domain_id) const;
+    RWDomain *domainByName(const QString &domain_name) const;
 
     int format_version;
     int game_system_id;
@@ -70,20 +111,57 @@ public:
     QString details_legal;
     QString details_other_notes;
 
+    // Optional limit on the size of the images for Picture and Smart_Image snippets (see ImageTransformer)
+    int image_max_dimension{0};
+    int image_quality{85};
+
+    // If set, URL assets are fetched by this (which is shared with other exports) rather than by each export
+    UrlAssetFetcher *url_assets{nullptr};
+
     int formatVersion() const;
     void forceFormatVersion(int version);
 
 signals:
     void modificationDone();
+    // Emitted from the thread running writeExportFile, about 30 times per second at most
+    void exportProgress(int value, int maximum, const QString &label);
 
 private:
     QString namespace_uri;
     int force_format_version{-1};
     int orig_format_version{-1};
+    QAtomicInt export_cancelled{0};
+    QElapsedTimer progress_timer;
+    QMutex progress_mutex;
+    QAtomicInt progress_value{0};
+    int progress_maximum{0};
+    QString progress_label;
+    QHash<QString,RWDomain*> domains_by_id;
+    QHash<QString,RWDomain*> domains_by_name;
+    void reportProgress(bool force = false);
+    void setProgressLabel(const QString &label);
+
+    void startExport();
+    QVector<ExportUnit> planExport(ExportContext &ctx,
+                                   const QList<RWTopic*> &body_topics,
+                                   const QAbstractItemModel *model,
+                                   IncrementalState *incremental);
+    void fetchUrlAssets(const ExportContext &ctx, const QAbstractItemModel *model,
+                        const QVector<ExportUnit> &units);
+    bool writeShard(QIODevice *device, const ExportContext &ctx,
+                    const QAbstractItemModel *model, const QVector<ExportUnit> &units);
+    bool writeShardFile(const QString &filename, const ExportContext &ctx,
+                        const QAbstractItemModel *model, const QVector<ExportUnit> &units);
+    static QVector<QVector<int>> parentGroups(const RWTopic *parent,
+                                              const QAbstractItemModel *model,
+                                              const QVector<int> &rows);
+    static void reportMessages(const ExportContext &ctx);
     RWStructureItem *read_element(QXmlStreamReader *reader, RWStructureItem *parent);
-    void writeParentToStructure(QProgressDialog &progress, QXmlStreamWriter *writer,
+    int  writeParentToStructure(QXmlStreamWriter *writer,
+                                const ExportContext &ctx,
                                 const RWTopic* body_topic,
                                 const QAbstractItemModel *model,
+                                const QVector<int> &rows,
                                 const QList<RWTopic*> &parent_topics);
 };
 
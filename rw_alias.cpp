@@ -17,6 +17,7 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "rw_alias.h"
+#include "exportcontext.h"
 
 #include <QMetaEnum>
 #include <QDataStream>
@@ -25,8 +26,6 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 static QMetaEnum case_matching_enum   = QMetaEnum::fromType<RWAlias::CaseMatching>();
 static QMetaEnum match_priority_enum  = QMetaEnum::fromType<RWAlias::MatchPriority>();
 
-static int g_alias_id = 1;
-
 RWAlias::RWAlias(QObject *parent) : QObject(parent),
     p_is_auto_accept(false), p_case_matching(Ignore), p_match_priority(Normal),
     p_is_show_nav_pane(true), p_is_true_name(false), p_is_revealed(false)
@@ -50,13 +49,13 @@ void RWAlias::writeAttributes(QXmlStreamWriter *writer, const QModelIndex &index
 }
 
 
-void RWAlias::writeToContents(QXmlStreamWriter *writer, const QModelIndex &index) const
+void RWAlias::writeToContents(QXmlStreamWriter *writer, const ExportContext &ctx, const QModelIndex &index, const QString &alias_id) const
 {
-    QString name = p_name_field.valueString(index);
+    QString name = ctx.valueString(p_name_field, index);
     if (!name.isEmpty())
     {
         writer->writeStartElement("alias");
-        writer->writeAttribute("alias_id", "Alias_" + QString::number(g_alias_id++));
+        writer->writeAttribute("alias_id", alias_id);
         writer->writeAttribute("name", name);
         writeAttributes(writer, index);
         if (p_is_true_name) writer->writeAttribute("is_true_name", "true");
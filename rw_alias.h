@@ -25,6 +25,7 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 class QDataStream;
 class QXmlStreamWriter;
 class QModelIndex;
+class ExportContext;
 
 class RWAlias : public QObject
 {
@@ -44,7 +45,7 @@ public:
     CaseMatching caseMatching() const { return p_case_matching; }
     MatchPriority matchPriority() const { return p_match_priority; }
 
-    virtual void writeToContents(QXmlStreamWriter*, const QModelIndex &index) const;
+    virtual void writeToContents(QXmlStreamWriter*, const ExportContext &ctx, const QModelIndex &index, const QString &alias_id) const;
     DataField &namefield()   { return p_name_field; }
     const DataField &namefield() const { return p_name_field; }
     void writeAttributes(QXmlStreamWriter *writer, const QModelIndex &index) const;
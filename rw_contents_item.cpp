@@ -22,7 +22,7 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <QModelIndex>
 #include <QDebug>
 #include "rw_category.h"    // to stop iteration into lower RWCategory
-#include "regexp.h"
+#include "urllinks.h"
 
 /*
  * These are the objects representing the items in the CONTENTS part of the RWEXPORT file.
@@ -37,7 +37,7 @@ RWContentsItem::RWContentsItem(RWStructureItem *item, RWContentsItem *parent) :
     p_revealed = item->attributes().value("is_revealed") == "true";
 }
 
-void RWContentsItem::writeToContents(QXmlStreamWriter *writer, const QModelIndex &index) const
+void RWContentsItem::writeToContents(QXmlStreamWriter *writer, const ExportContext &ctx, const QModelIndex &index) const
 {
     // Special case: never put text_override into the contents section
     if (structure->ignoreForContents()) return;
@@ -48,16 +48,16 @@ void RWContentsItem::writeToContents(QXmlStreamWriter *writer, const QModelIndex
 
     //QString user_text = p_text.valueString(index);
     //if (!user_text.isEmpty()) writer->writeCharacters(user_text);
-    writeChildrenToContents(writer, index);
+    writeChildrenToContents(writer, ctx, index);
     writer->writeEndElement();
 }
 
-void RWContentsItem::writeChildrenToContents(QXmlStreamWriter *writer, const QModelIndex &index) const
+void RWContentsItem::writeChildrenToContents(QXmlStreamWriter *writer, const ExportContext &ctx, const QModelIndex &index) const
 {
     // Get only the content items (ignore all RWCategory children)
     for (auto item: childItems<RWContentsItem*>())
     {
-        item->writeToContents(writer, index);
+        item->writeToContents(writer, ctx, index);
     }
 }
 
@@ -95,6 +95,130 @@ QString RWContentsItem::xmlParagraph(const QString &text, TextClass text_class,
     return QString();
 }
 
+/**
+ * @brief span_start
+ * @return the start tag of a span of text with the given style.
+ */
+static QString span_start(bool bold, bool italic, bool line_through, bool underline)
+{
+    // text-decoration is a space separated list, the style is a semi-colon separated list
+    QString style;
+    if (underline || line_through)
+    {
+        style = "text-decoration:";
+        if (underline) style += "underline";
+        if (underline && line_through) style += ' ';
+        if (line_through) style += "line-through";
+    }
+    if (bold) style += style.isEmpty() ? "font-weight:bold" : ";font-weight:bold";
+    if (italic) style += style.isEmpty() ? "font-style:italic" : ";font-style:italic";
+
+    if (style.isEmpty()) return "<span class=\"RWSnippet\">";
+    return "<span class=\"RWSnippet\" style=\"" + style + "\">";
+}
+
+/**
+ * @brief append_escaped
+ * Appends the text as it appears in XML character data (as written by QXmlStreamWriter::writeCharacters).
+ * @param out
+ * @param text
+ * @param html if true, the text is first escaped as HTML (as by QString::toHtmlEscaped),
+ * so the result is the same as escaping it twice.
+ */
+static void append_escaped(QString &out, const QStringRef &text, bool html)
+{
+    const QChar *run = text.unicode();
+    const QChar *end = run + text.size();
+    for (const QChar *pos = run; pos < end; pos++)
+    {
+        const char *replacement;
+        switch (pos->unicode())
+        {
+        case '<':  replacement = html ? "&amp;lt;"   : "&lt;";   break;
+        case '>':  replacement = html ? "&amp;gt;"   : "&gt;";   break;
+        case '&':  replacement = html ? "&amp;amp;"  : "&amp;";  break;
+        case '"':  replacement = html ? "&amp;quot;" : "&quot;"; break;
+        case '\t':
+        case '\n':
+        case '\r':
+            continue;
+        default:
+            if (pos->unicode() >= 0x20 && pos->unicode() < 0xfffe) continue;
+            replacement = "";   // not allowed in XML (QXmlStreamWriter leaves these out too)
+            break;
+        }
+        out.append(run, int(pos - run));
+        out.append(QLatin1String(replacement));
+        run = pos + 1;
+    }
+    out.append(run, int(end - run));
+}
+
+static QString escaped(const QString &markup)
+{
+    QString result;
+    append_escaped(result, QStringRef(&markup), /*html*/ false);
+    return result;
+}
+
+/**
+ * @brief RWContentsItem::writeRichText
+ * Writes an element containing the text as RWDefault paragraphs, the same as
+ *   writer->writeTextElement(element, xmlParagraph(xmlSpan(paragraph, bold)) for each paragraph)
+ * but without building the markup for each paragraph as separate strings:
+ * the markup and the text are escaped in a single pass, straight into one buffer which is then written
+ * to the writer's device (so the writer must be writing UTF-8 to a device, as it does for the export file).
+ * @param writer
+ * @param element the name of the element
+ * @param text
+ * @param split_paragraphs if true, then each part of the text separated by a blank line is a separate paragraph
+ * @param bold
+ */
+void RWContentsItem::writeRichText(QXmlStreamWriter *writer, const QString &element, const QString &text,
+                                   bool split_paragraphs, bool bold)
+{
+    Q_ASSERT(writer->device() != nullptr);
+
+    // The markup is the same for every paragraph
+    const QString para_start = escaped("<p class=\"RWDefault\">");
+    const QString para_end   = escaped("</p>");
+    const QString start_rwsnippet = escaped(span_start(bold, false, false, false));
+    const QString end_rwsnippet   = escaped("</span>");
+
+    const QVector<QStringRef> paragraphs = split_paragraphs ? text.splitRef("\n\n") : QVector<QStringRef>{QStringRef(&text)};
+
+    QString out;
+    out.reserve(text.size() + text.size() / 8 + paragraphs.size() * (para_start.size() + start_rwsnippet.size() + 32));
+    for (const QStringRef &para : paragraphs)
+    {
+        out.append(para_start);
+        if (para.startsWith(QLatin1String("<span class=")) && para.endsWith(QLatin1String("</span>")))
+        {
+            // Formatting already done (see xmlSpan)
+            append_escaped(out, para, /*html*/ false);
+        }
+        else if (mayContainUrl(para))
+        {
+            const QString span = xmlSpan(para.toString(), bold);
+            append_escaped(out, QStringRef(&span), /*html*/ false);
+        }
+        else
+        {
+            out.append(start_rwsnippet);
+            // Prevent "<" being interpreted as the start of an element, but not if the entire field looks like XML/HTML
+            append_escaped(out, para, /*html*/ !(para.startsWith('<') && para.endsWith('>')));
+            out.append(end_rwsnippet);
+        }
+        out.append(para_end);
+    }
+
+    // Ensure that the start tag is complete before writing the contents directly to the device
+    writer->writeStartElement(element);
+    writer->writeCharacters(QString());
+    writer->device()->write(out.toUtf8());
+    writer->writeEndElement();
+}
+
 QString RWContentsItem::xmlSpan(const QString &text, bool bold, bool italic, bool line_through, bool underline)
 {
     // Special situation where the formatting has already been done (e.g. by excel_xlsxmodel.cpp)
@@ -109,23 +233,7 @@ QString RWContentsItem::xmlSpan(const QString &text, bool bold, bool italic, boo
     qDebug() << "xmlSpan: applying formatting" << text;
 #endif
 
-    // text-decoration - space separated list
-    QStringList decorations;
-    if (underline) decorations.append("underline");
-    if (line_through) decorations.append("line-through");
-    // Styles - semi-colon separated list
-    QStringList styles;
-    if (!decorations.isEmpty()) styles.append("text-decoration:" + decorations.join(' '));
-    if (bold) styles.append("font-weight:bold");
-    if (italic) styles.append("font-style:italic");
-
-    QString style;
-    if (!styles.isEmpty())
-    {
-        style = " style=\"" + styles.join(';') + "\"";
-    }
-
-    const QString start_rwsnippet(QString("<span class=\"RWSnippet\"%1>").arg(style));
+    const QString start_rwsnippet = span_start(bold, italic, line_through, underline);
 
     // Subscript   uses <sub> ... </sub>
     // Superscript uses <sup> ... </sup>
@@ -138,8 +246,11 @@ QString RWContentsItem::xmlSpan(const QString &text, bool bold, bool italic, boo
     }
 
     // Parse for possible URLs, remembering style for future text
-    const QString url_replacement("<a class=\"RWLink\" style=\"color:#000000;text-decoration:none\" href=\"\\1\" title=\"\\1\"><span class=\"RWLink\">\\1</span></a></span>" + start_rwsnippet);
-    QString result = start_rwsnippet + buffer.replace(url_regexp, url_replacement) + "</span>";
+    QString result;
+    result.reserve(start_rwsnippet.size() + buffer.size() + 7);
+    result.append(start_rwsnippet);
+    appendLinkedText(result, buffer, start_rwsnippet);
+    result.append("</span>");
 #ifdef DEBUG_SPAN
     qDebug() << "xmlSpan:   output =" << result;
 #endif
@@ -25,6 +25,7 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 class QModelIndex;
 class QXmlStreamWriter;
+class ExportContext;
 class RWStructure;
 class RWStructureItem;
 
@@ -72,7 +73,7 @@ public:
     QString structureText() const { return p_structure_text; }
     void setStructureText(const QString &text) { p_structure_text = text; }
 
-    virtual void writeToContents(QXmlStreamWriter*, const QModelIndex &index) const;
+    virtual void writeToContents(QXmlStreamWriter*, const ExportContext &ctx, const QModelIndex &index) const;
     virtual void postLoad(void) {}
 
     bool isRevealed() const { return p_revealed; }
@@ -87,6 +88,8 @@ public:
     static QString xmlSpan(const QString &contentsText,
                            bool bold = false, bool italic = false,
                            bool line_through = false, bool underline = false);
+    static void writeRichText(QXmlStreamWriter *writer, const QString &element, const QString &text,
+                              bool split_paragraphs, bool bold = false);
 
     template<typename T>
     inline QList<T> childItems() const { return findChildren<T>(QString(), Qt::FindDirectChildrenOnly); }
@@ -95,7 +98,7 @@ public:
     void writeExportTag(QXmlStreamWriter *writer) const;
 
 protected:
-    virtual void writeChildrenToContents(QXmlStreamWriter *writer, const QModelIndex &index) const;
+    virtual void writeChildrenToContents(QXmlStreamWriter *writer, const ExportContext &ctx, const QModelIndex &index) const;
 
 private:
     DataField p_contents_text;
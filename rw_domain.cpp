@@ -20,27 +20,9 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <QXmlStreamWriter>
 #include <QDebug>
 
-static QMap<QString,RWDomain*> all_domains_by_id;
-static QMap<QString,RWDomain*> all_domains_by_name;
-
 RWDomain::RWDomain(QXmlStreamReader *stream, QObject *parent) :
     RWStructureItem(stream, parent)
 {
-    all_domains_by_id.insert(id(), this);
-    all_domains_by_name.insert(name(), this);
-}
-
-
-RWDomain *RWDomain::getDomainById(const QString &domain_id)
-{
-    if (domain_id.isEmpty()) return nullptr;
-    return all_domains_by_id.value(domain_id);
-}
-
-
-RWDomain *RWDomain::getDomainByName(const QString &domain_id)
-{
-    return all_domains_by_name.value(domain_id);
 }
 
 
@@ -57,17 +39,47 @@ QStringList RWDomain::tagNames() const
     return result;
 }
 
-QString RWDomain::tagId(const QString &tag_name) const
+/**
+ * @brief RWDomain::postLoad
+ * Builds the index of tag names, once all the tags of the domain have been read.
+ */
+void RWDomain::postLoad()
 {
+    tag_ids.clear();
     for (auto tag: childItems<RWStructureItem*>())
     {
-        if (tag->structureElement().startsWith("tag") &&
-                tag->name().compare(tag_name, Qt::CaseInsensitive) == 0)
-        {
-            return tag->id();
-        }
+        // The first tag with a particular name is the one which is used
+        const QString key = tag->name().toCaseFolded();
+        if (tag->structureElement().startsWith("tag") && !tag_ids.contains(key))
+            tag_ids.insert(key, tag->id());
     }
-    return QString();
+}
+
+/**
+ * @brief RWDomain::tagId
+ * @param tag_name the name of the tag (case insensitive)
+ * @return the ID of the tag, or an empty string if the domain doesn't have a tag of that name.
+ */
+QString RWDomain::tagId(const QString &tag_name) const
+{
+    return tag_ids.value(tag_name.toCaseFolded());
+}
+
+/**
+ * @brief RWDomain::tagList
+ * @param tag_names a comma-separated list of tag names
+ * @return the name and ID of each tag in the list.
+ * This may be called from several threads at once (tag_ids isn't changed after postLoad).
+ */
+RWDomain::TagList RWDomain::tagList(const QString &tag_names) const
+{
+    TagList result;
+    for (auto tag_name: tag_names.split(","))
+    {
+        const QString name = tag_name.trimmed();
+        result.append(qMakePair(name, tagId(name)));
+    }
+    return result;
 }
 
 RWContentsItem *RWDomain::createContentsItem(RWContentsItem *parent)
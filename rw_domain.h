@@ -20,6 +20,9 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "rw_structure_item.h"
+#include <QHash>
+#include <QPair>
+#include <QVector>
 
 class QXmlStreamWriter;
 
@@ -30,12 +33,19 @@ class RWDomain : public RWStructureItem
     Q_OBJECT
 public:
     RWDomain(QXmlStreamReader *stream, QObject *parent = nullptr);
-    static RWDomain *getDomainById(const QString &domain_id);
-    static RWDomain *getDomainByName(const QString &domain_id);
     QStringList tagNames() const;
     QString tagId(const QString &tag_name) const;
+
+    // The (trimmed) name and ID of each tag in a comma-separated list (the ID is empty for an unknown tag)
+    typedef QVector<QPair<QString,QString>> TagList;
+    TagList tagList(const QString &tag_names) const;
+
+    virtual void postLoad() override;
 protected:
     virtual RWContentsItem *createContentsItem(RWContentsItem *parent);
+private:
+    // The ID of each tag, by case-folded name
+    QHash<QString,QString> tag_ids;
 };
 
 #endif // RW_DOMAIN_H
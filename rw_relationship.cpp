@@ -20,9 +20,9 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <QMetaEnum>
 #include <QXmlStreamWriter>
 #include <QDataStream>
-#include <QPointer>
 #include <QAbstractProxyModel>
 #include "rw_domain.h"
+#include "exportcontext.h"
 #include "rw_topic.h"
 #include "datafield.h"
 
@@ -39,22 +39,22 @@ static const QMap<QString,QString> attitudeId{
 static QMetaEnum nature_enum   = QMetaEnum::fromType<RWRelationship::Nature>();
 static QMetaEnum attitude_enum = QMetaEnum::fromType<RWRelationship::Attitude>();
 
-// If a new structure file is loaded, then the following two pointers should get reset to nullptr automatically
-static QPointer<RWDomain> comprises_domain;
-static QPointer<RWDomain> generic_domain;
-
-
 RWRelationship::RWRelationship(QObject *parent) : QObject(parent)
 {
 }
 
-
-void RWRelationship::writeToContents(QXmlStreamWriter *writer, const QModelIndex &index) const
+/**
+ * @brief RWRelationship::writeToContents
+ * @param writer
+ * @param ctx the export being generated (which provides the relationship domains, and the index of target rows)
+ * @param index
+ */
+void RWRelationship::writeToContents(QXmlStreamWriter *writer, const ExportContext &ctx, const QModelIndex &index) const
 {
     if (p_this_link.modelColumn() < 0 || p_other_link.modelColumn() < 0) return;
 
     // Get actual value from the current ROW
-    QString value_to_match = p_this_link.valueString(index);
+    QString value_to_match = ctx.valueString(p_this_link, index);
     if (value_to_match.isEmpty()) return;
 
     // Find the base model
@@ -63,11 +63,17 @@ void RWRelationship::writeToContents(QXmlStreamWriter *writer, const QModelIndex
         model = proxy->sourceModel();
 
     // Create one connection for each matching topic
-    const QModelIndexList topics = model->match(model->index(0, p_other_link.modelColumn()), Qt::DisplayRole, value_to_match, /*hits*/ -1, Qt::MatchExactly);
-    for (auto other_index : topics)
+    const QVector<int> topics = ctx.relationshipTargets(model, ctx.column(p_other_link), value_to_match);
+    for (int other_row : topics)
     {
+        // A connection can only refer to a topic in the same file
+        if (ctx.rowInOtherShard(other_row))
+        {
+            ctx.omitConnection();
+            continue;
+        }
         writer->writeStartElement("connection");
-        writer->writeAttribute("target_id", other_index.data(Qt::UserRole).toString());
+        writer->writeAttribute("target_id", ctx.rowTopicId(model->index(other_row, 0)));
         writer->writeAttribute("nature", nature_enum.valueToKey(nature));
 
         switch (nature)
@@ -75,15 +81,13 @@ void RWRelationship::writeToContents(QXmlStreamWriter *writer, const QModelIndex
         case Master_To_Minion:
         //case Minion_To_Master:
             // Requires tag from "Comprises Relationship Types" domain
-            if (comprises_domain.isNull()) comprises_domain = RWDomain::getDomainByName("Comprises Relationship Types");
-            writer->writeAttribute("qualifier_tag_id", comprises_domain->tagId(qualifier_tag_name));
+            writer->writeAttribute("qualifier_tag_id", ctx.domainByName("Comprises Relationship Types")->tagId(qualifier_tag_name));
             writer->writeAttribute("qualifier", qualifier_tag_name);
             break;
 
         case Generic:
             // Requires tag from "Generic Relationship Types" domain
-            if (generic_domain.isNull()) generic_domain = RWDomain::getDomainByName("Generic Relationship Types");
-            writer->writeAttribute("qualifier_tag_id", generic_domain->tagId(qualifier_tag_name));
+            writer->writeAttribute("qualifier_tag_id", ctx.domainByName("Generic Relationship Types")->tagId(qualifier_tag_name));
             writer->writeAttribute("qualifier", qualifier_tag_name);
             break;
 
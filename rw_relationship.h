@@ -23,6 +23,7 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "datafield.h"
 
 class QXmlStreamWriter;
+class ExportContext;
 
 class RWRelationship : public QObject
 {
@@ -46,7 +47,7 @@ public:
     Attitude attitude;
     QString qualifier_tag_name;
 
-    void writeToContents(QXmlStreamWriter*, const QModelIndex &index) const;
+    void writeToContents(QXmlStreamWriter*, const ExportContext &ctx, const QModelIndex &index) const;
 
 signals:
 
@@ -25,6 +25,7 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <QDebug>
 #include "fieldlineedit.h"
 #include "rw_domain.h"
+#include "realmworksstructure.h"
 
 static QMetaEnum nature_enum   = QMetaEnum::fromType<RWRelationship::Nature>();
 static QMetaEnum attitude_enum = QMetaEnum::fromType<RWRelationship::Attitude>();
@@ -113,7 +114,7 @@ void RWRelationshipWidget::setNature(const QString &reason)
     case RWRelationship::Master_To_Minion:
     //case RWRelationship::Minion_To_Master:
         // Requires tag from "Comprises Relationship Types" domain
-        domain = RWDomain::getDomainByName("Comprises Relationship Types");
+        domain = RealmWorksStructure::theInstance()->domainByName("Comprises Relationship Types");
         if (domain == nullptr) return;
         qualifier->addItems(domain->tagNames());
         qualifier->show();
@@ -121,7 +122,7 @@ void RWRelationshipWidget::setNature(const QString &reason)
 
     case RWRelationship::Generic:
         // Requires tag from "Generic Relationship Types" domain
-        domain = RWDomain::getDomainByName("Generic Relationship Types");
+        domain = RealmWorksStructure::theInstance()->domainByName("Generic Relationship Types");
         if (domain == nullptr) return;
         qualifier->addItems(domain->tagNames());
         qualifier->show();
@@ -19,6 +19,7 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "rw_partition.h"
 #include "rw_section.h"
 #include "rw_snippet.h"
+#include "exportcontext.h"
 #include <QDebug>
 #include <QXmlStreamWriter>
 #include <QMetaEnum>
@@ -33,38 +34,37 @@ RWSection::RWSection(RWPartition *partition, RWContentsItem *parent) :
 {
 }
 
-void RWSection::writeToContents(QXmlStreamWriter *writer, const QModelIndex &index) const
+void RWSection::writeToContents(QXmlStreamWriter *writer, const ExportContext &ctx, const QModelIndex &index) const
 {
     if (p_is_multiple && p_first_multiple.modelColumn() >= 0)
     {
         if (p_second_multiple.modelColumn() == -1)
         {
             // Custom name for the section
-            write_one(writer, "name", p_first_multiple.valueString(index).left(50), index);
+            write_one(writer, ctx, "name", ctx.valueString(p_first_multiple, index).left(50), index);
         }
         else
         {
             // Ensure last column is valid
-            int first_column  = p_first_multiple.modelColumn();
-            int second_column = p_second_multiple.modelColumn();
-            int last_column   = p_last_multiple.modelColumn();
-            if (last_column == -1) last_column = index.model()->columnCount();
-            // Handle multiple repetitions of the same section
+            int first_column  = ctx.column(p_first_multiple);
+            int second_column = ctx.column(p_second_multiple);
+            int last_column   = ctx.column(p_last_multiple);
+            if (p_last_multiple.modelColumn() == -1) last_column = index.model()->columnCount();
+            // Handle multiple repetitions of the same section;
+            // each repetition is rendered with its own column offset.
             int step = second_column - first_column;
             for (int column = first_column; column <= last_column; column += step)
             {
-                DataField::setColumnOffset(column - first_column);
                 QString name = index.sibling(index.row(), column).data().toString();
                 if (name.isEmpty()) break;
                 // Name is an xs:token of 1-50 characters
-                write_one(writer, "name", name.left(50), index);
+                write_one(writer, ctx.withColumnOffset(ctx.columnOffset() + column - first_column), "name", name.left(50), index);
             }
-            DataField::setColumnOffset(0);
         }
     }
     else
     {
-        write_one(writer, "partition_id", structure->id(), index);
+        write_one(writer, ctx, "partition_id", structure->id(), index);
     }
 }
 
@@ -84,22 +84,19 @@ void RWSection::write_text(QXmlStreamWriter *writer, const QString &user_text, c
 
             if (!user_text.isEmpty())
             {
-                QString text;
-                for (auto para: user_text.split("\n\n"))
-                    text.append(xmlParagraph(xmlSpan(para, bold)));
-                writer->writeTextElement("contents", text);
+                writeRichText(writer, "contents", user_text, /*split_paragraphs*/ true, bold);
             }
             // Maybe some GM directions
             if (!gm_dir.isEmpty())
             {
-                writer->writeTextElement("gm_directions", xmlParagraph(xmlSpan(gm_dir, /*bold*/ false)));
+                writeRichText(writer, "gm_directions", gm_dir, /*split_paragraphs*/ false);
             }
         }
         writer->writeEndElement(); // snippet
     }
 }
 
-void RWSection::write_one(QXmlStreamWriter *writer, const QString &attr_name, const QString &attr_value, const QModelIndex &index) const
+void RWSection::write_one(QXmlStreamWriter *writer, const ExportContext &ctx, const QString &attr_name, const QString &attr_value, const QModelIndex &index) const
 {
     writer->writeStartElement("section");
     if (!structure->id().isEmpty()) writer->writeAttribute(attr_name, attr_value);
@@ -108,25 +105,25 @@ void RWSection::write_one(QXmlStreamWriter *writer, const QString &attr_name, co
     // First = child sections
     for (auto section: childItems<RWSection*>())
     {
-        section->writeToContents(writer, index);
+        section->writeToContents(writer, ctx, index);
     }
 
     // Second = Snippets
     for (auto snippet: childItems<::RWSnippet*>())
     {
-        snippet->writeToContents(writer, index);
+        snippet->writeToContents(writer, ctx, index);
     }
 
     // It may have some text directly on it, not stored in a facet
-    write_text(writer, contentsText().valueString(index), gmDirections().valueString(index));
-    int last_column = lastContents().modelColumn();
+    write_text(writer, ctx.valueString(contentsText(), index), ctx.valueString(gmDirections(), index));
+    int last_column = ctx.column(lastContents());
     if (last_column >= 0)
     {
         if (gmDirections().modelColumn() >= 0)
-            for (int text_column = contentsText().modelColumn()+1, gm_column = gmDirections().modelColumn()+1; text_column <= last_column; text_column++, gm_column++)
+            for (int text_column = ctx.column(contentsText())+1, gm_column = ctx.column(gmDirections())+1; text_column <= last_column; text_column++, gm_column++)
                 write_text(writer, index.sibling(index.row(), text_column).data().toString(), index.sibling(index.row(), gm_column).data().toString());
         else
-            for (int text_column = contentsText().modelColumn()+1; text_column <= last_column; text_column++)
+            for (int text_column = ctx.column(contentsText())+1; text_column <= last_column; text_column++)
                 write_text(writer, index.sibling(index.row(), text_column).data().toString(), QString());
     }
 
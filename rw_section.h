@@ -30,7 +30,7 @@ class RWSection : public RWContentsItem
     Q_OBJECT
 public:
     RWSection(RWPartition *partition, RWContentsItem *parent);
-    virtual void writeToContents(QXmlStreamWriter*, const QModelIndex &index) const;
+    virtual void writeToContents(QXmlStreamWriter*, const ExportContext &ctx, const QModelIndex &index) const;
     const RWPartition *const partition;
 
     DataField &firstMultiple() { return p_first_multiple; }
@@ -49,7 +49,7 @@ public:
     bool p_start_collapsed{false};
     bool p_is_multiple{false};
 private:
-    void write_one(QXmlStreamWriter*, const QString &attr_name, const QString &attr_value, const QModelIndex &index) const;
+    void write_one(QXmlStreamWriter*, const ExportContext &ctx, const QString &attr_name, const QString &attr_value, const QModelIndex &index) const;
     void write_text(QXmlStreamWriter *writer, const QString &user_text, const QString &gm_dir) const;
     DataField p_first_multiple;
     DataField p_second_multiple;
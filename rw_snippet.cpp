@@ -25,13 +25,14 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <QFile>
 #include <QFileInfo>
 #include <QMessageBox>
-#include <QNetworkAccessManager>
-#include <QNetworkReply>
 #include <QCoreApplication>
 
 #include "datafield.h"
 #include "rw_domain.h"
 #include "rw_facet.h"
+#include "exportcontext.h"
+#include "assetcache.h"
+#include "urlassetfetcher.h"
 
 static QMetaEnum snip_type_enum  = QMetaEnum::fromType<RWFacet::SnippetType>();
 static QMetaEnum snip_veracity_enum = QMetaEnum::fromType<RWContentsItem::SnippetVeracity>();
@@ -51,27 +52,45 @@ RWSnippet::RWSnippet(RWFacet *facet, RWContentsItem *parent) :
 }
 
 
-static QString to_gregorian(const QString &from)
+/**
+ * @brief RWSnippet::isValidDate
+ * @param date
+ * @return true if the date can be put into a "gregorian" attribute (see to_gregorian).
+ */
+bool RWSnippet::isValidDate(const QString &date)
 {
-    // TODO - Realm Works does not like "gregorian" fields in this format!
-
     /* Must be [Y]YYYY-MM-DD hh:mm:ss[ BCE]
      * year limit is 20000 */
-    if (from.length() >= 19) return from;
+    return date.length() >= 19 || date.length() == 10 || date.length() == 11;
+}
+
+QString RWSnippet::invalidDateMessage(const QString &date)
+{
+    return QString("INVALID DATE FORMAT: %1 (should be [Y]YYYY-MM-DD HH:MM:SS)").arg(date);
+}
+
+static QString to_gregorian(const QString &from, const ExportContext &ctx)
+{
+    // TODO - Realm Works does not like "gregorian" fields in this format!
+
+    if (!RWSnippet::isValidDate(from))
+    {
+        ctx.addMessage(RWSnippet::invalidDateMessage(from));
+        return from;
+    }
     // If no time in the field, then simply append midnight time */
-    if (from.length() == 10 || from.length() == 11) return from + " 00:00:00";
-    qWarning() << "INVALID DATE FORMAT:" << from << "(should be [Y]YYYY-MM-DD HH:MM:SS)";
+    if (from.length() < 19) return from + " 00:00:00";
     return from;
 }
 
 
-void RWSnippet::writeToContents(QXmlStreamWriter *writer, const QModelIndex &index) const
+void RWSnippet::writeToContents(QXmlStreamWriter *writer, const ExportContext &ctx, const QModelIndex &index) const
 {
     Q_UNUSED(index);
     bool bold = false;
 
     // Ignore date snippets if no data available
-    const QString start_date  = startDate().valueString(index);
+    const QString start_date  = ctx.valueString(startDate(), index);
     if ((facet->snippetType() == RWFacet::Date_Game || facet->snippetType() == RWFacet::Date_Range) && start_date.isEmpty())
     {
         return;
@@ -79,11 +98,11 @@ void RWSnippet::writeToContents(QXmlStreamWriter *writer, const QModelIndex &ind
 
     writer->writeStartElement("snippet");
     {
-        const QString user_text = contentsText().valueString(index);
-        const QString gm_dir    = gmDirections().valueString(index);
-        const QVariant asset    = filename().value(index);
-        const QString finish_date = finishDate().valueString(index);
-        QString digits = number().valueString(index);
+        const QString user_text = ctx.valueString(contentsText(), index);
+        const QString gm_dir    = ctx.valueString(gmDirections(), index);
+        const QVariant asset    = ctx.value(filename(), index);
+        const QString finish_date = ctx.valueString(finishDate(), index);
+        QString digits = ctx.valueString(number(), index);
 
         if (!structure->id().isEmpty()) writer->writeAttribute("facet_id", structure->id());
         writer->writeAttribute("type", snip_type_enum.valueToKey(facet->snippetType()));
@@ -98,7 +117,7 @@ void RWSnippet::writeToContents(QXmlStreamWriter *writer, const QModelIndex &ind
             writer->writeAttribute("purpose",
                                    ((ft == RWFacet::Multi_Line || ft == RWFacet::Labeled_Text ||
                                      ft == RWFacet::Tag_Standard ||
-                                     ft == RWFacet::Numeric) && user_text.isEmpty() && p_tags.valueString(index).isEmpty()) ? "Directions_Only" : "Both");
+                                     ft == RWFacet::Numeric) && user_text.isEmpty() && ctx.valueString(p_tags, index).isEmpty()) ? "Directions_Only" : "Both");
         }
 
 #if 0
@@ -128,10 +147,7 @@ void RWSnippet::writeToContents(QXmlStreamWriter *writer, const QModelIndex &ind
             case RWFacet::Multi_Line:
             case RWFacet::Labeled_Text:
             {
-                QString text;
-                for (auto para: user_text.split("\n\n"))
-                    text.append(xmlParagraph(xmlSpan(para, bold)));
-                writer->writeTextElement(CONTENTS_TOKEN, text);
+                writeRichText(writer, CONTENTS_TOKEN, user_text, /*split_paragraphs*/ true, bold);
                 // No annotation for these two snippet types
                 check_annotation = false;
                 break;
@@ -148,14 +164,14 @@ void RWSnippet::writeToContents(QXmlStreamWriter *writer, const QModelIndex &ind
 #if 1
                     digits.toFloat(&ok);
                     if (!ok)
-                        qWarning() << tr("Non-numeric characters in numeric field: %1").arg(digits);
+                        ctx.addMessage(tr("Non-numeric characters in numeric field: %1").arg(digits));
                     else
                         writer->writeTextElement(CONTENTS_TOKEN, digits);
 #else
                     const QLocale &locale = QLocale::system();
                     locale.toFloat(digits, &ok);
                     if (!ok)
-                        qWarning() << tr("Non-numeric characters in numeric field: %1").arg(digits);
+                        ctx.addMessage(tr("Non-numeric characters in numeric field: %1").arg(digits));
                     else
                     {
                         // Handle locale details:
@@ -171,51 +187,51 @@ void RWSnippet::writeToContents(QXmlStreamWriter *writer, const QModelIndex &ind
 
                 // There are a lot of snippet types which have an ext_object child (which has an asset child)
             case RWFacet::Foreign:
-                write_ext_object(writer, "Foreign", asset);
+                write_ext_object(writer, ctx, "Foreign", asset);
                 break;
             case RWFacet::Statblock: // this might require an .rtf file?
-                write_ext_object(writer, "Statblock", asset);
+                write_ext_object(writer, ctx, "Statblock", asset);
                 break;
             case RWFacet::Portfolio: // requires a HeroLab portfolio
-                write_ext_object(writer, "Portfolio", asset);
+                write_ext_object(writer, ctx, "Portfolio", asset);
                 break;
             case RWFacet::Picture:
-                write_ext_object(writer, "Picture", asset);
+                write_ext_object(writer, ctx, "Picture", asset);
                 break;
             case RWFacet::Rich_Text:
-                write_ext_object(writer, "Rich_Text", asset);
+                write_ext_object(writer, ctx, "Rich_Text", asset);
                 break;
             case RWFacet::PDF:
-                write_ext_object(writer, "PDF", asset);
+                write_ext_object(writer, ctx, "PDF", asset);
                 break;
             case RWFacet::Audio:
-                write_ext_object(writer, "Audio", asset);
+                write_ext_object(writer, ctx, "Audio", asset);
                 break;
             case RWFacet::Video:
-                write_ext_object(writer, "Video", asset);
+                write_ext_object(writer, ctx, "Video", asset);
                 break;
             case RWFacet::HTML:
-                write_ext_object(writer, "HTML", asset);
+                write_ext_object(writer, ctx, "HTML", asset);
                 break;
 
             case RWFacet::Smart_Image:
                 // Slightly different format since it has a smart_image child (which has an asset child)
-                write_smart_image(writer, asset);
+                write_smart_image(writer, ctx, asset);
                 break;
 
             case RWFacet::Date_Game:
                 writer->writeStartElement("game_date");
                 //writer->writeAttribute("canonical", start_date);
-                writer->writeAttribute("gregorian", to_gregorian(start_date));
+                writer->writeAttribute("gregorian", to_gregorian(start_date, ctx));
                 writer->writeEndElement();
                 break;
 
             case RWFacet::Date_Range:
                 writer->writeStartElement("date_range");
                 //writer->writeAttribute("canonical_start", start_date);
-                writer->writeAttribute("gregorian_start", to_gregorian(start_date));
+                writer->writeAttribute("gregorian_start", to_gregorian(start_date, ctx));
                 //writer->writeAttribute("canonical_end",   finish_date);
-                writer->writeAttribute("gregorian_end",   to_gregorian(finish_date));
+                writer->writeAttribute("gregorian_end",   to_gregorian(finish_date, ctx));
                 writer->writeEndElement();
                 break;
 
@@ -225,28 +241,28 @@ void RWSnippet::writeToContents(QXmlStreamWriter *writer, const QModelIndex &ind
 
             if (check_annotation && !user_text.isEmpty())
             {
-                writer->writeTextElement("annotation", xmlParagraph(xmlSpan(user_text, /*bold*/ false)));
+                writeRichText(writer, "annotation", user_text, /*split_paragraphs*/ false);
             }
         }
 
         // Maybe some GM directions
         if (!gm_dir.isEmpty())
         {
-            writer->writeTextElement("gm_directions", xmlParagraph(xmlSpan(gm_dir, /*bold*/ false)));
+            writeRichText(writer, "gm_directions", gm_dir, /*split_paragraphs*/ false);
         }
 
         // Maybe one or more TAG_ASSIGN (to be entered AFTER the contents/annotation)
-        QString tag_names = p_tags.valueString(index);
+        QString tag_names = ctx.valueString(p_tags, index);
         if (!tag_names.isEmpty())
         {
             // Find the domain to use
             QString domain_id = structure->attributes().value("domain_id").toString();
-            RWDomain *domain = RWDomain::getDomainById(domain_id);
+            RWDomain *domain = ctx.domainById(domain_id);
             if (domain)
             {
-                for (auto tag_name: tag_names.split(","))
+                for (auto &tag: domain->tagList(tag_names))
                 {
-                    QString tag_id = domain->tagId(tag_name.trimmed());
+                    const QString &tag_id = tag.second;
                     if (!tag_id.isEmpty())
                     {
                         writer->writeStartElement("tag_assign");
@@ -256,20 +272,20 @@ void RWSnippet::writeToContents(QXmlStreamWriter *writer, const QModelIndex &ind
                         writer->writeEndElement();
                     }
                     else
-                        qWarning() << "No TAG defined for" << tag_name.trimmed() << "in DOMAIN" << domain->name();
+                        ctx.addMessage(QString("No TAG defined for \"%1\" in DOMAIN \"%2\"").arg(tag.first).arg(domain->name()));
                 }
             }
             else if (!domain_id.isEmpty())
-                qWarning() << "DOMAIN not found for" << domain_id << "on FACET" << structure->id();
+                ctx.addMessage(QString("DOMAIN not found for %1 on FACET %2").arg(domain_id).arg(structure->id()));
             else
-                qWarning() << "domain_id does not exist on FACET" << structure->id();
+                ctx.addMessage(QString("domain_id does not exist on FACET %1").arg(structure->id()));
         }
 
     }
     writer->writeEndElement();  // snippet
 }
 
-void RWSnippet::write_asset(QXmlStreamWriter *writer, const QVariant &asset) const
+void RWSnippet::write_asset(QXmlStreamWriter *writer, const ExportContext &ctx, const QVariant &asset, bool is_picture) const
 {
     const int FILENAME_TYPE_LENGTH = 200;
     // Images can be put inside immediately
@@ -287,18 +303,33 @@ void RWSnippet::write_asset(QXmlStreamWriter *writer, const QVariant &asset) con
         return;
     }
 
-    QFile file(asset.toString());
+    QFileInfo info(ctx.assetPath(asset.toString()));
     QUrl url(asset.toString());
-    if (file.open(QFile::ReadOnly))
+    // The same file is often used by many topics, so it is only read and encoded once (see AssetCache).
+    if (info.isFile() && info.isReadable())
     {
-        QFileInfo info(file);
+        // Pictures might be replaced by a smaller copy (which may be in a different format)
+        QFileInfo contents(is_picture ? ctx.pictureFile(info.absoluteFilePath()) : info.absoluteFilePath());
+        QString asset_name = (contents == info) ? info.fileName() : info.completeBaseName() + '.' + contents.suffix();
+
+        // Nothing can be taken back once the encoding has started, so check that the file can be read first.
+        if (!ctx.assetCache().prepare(contents.absoluteFilePath()))
+        {
+            ctx.addMessage(tr("Failed to read file: %1").arg(contents.absoluteFilePath()));
+            return;
+        }
 
         writer->writeStartElement("asset");
-        writer->writeAttribute("filename", info.fileName().right(FILENAME_TYPE_LENGTH));
+        writer->writeAttribute("filename", asset_name.right(FILENAME_TYPE_LENGTH));
         //writer->writeAttribute("thumbnail_size", info.fileName());
 
-        QByteArray contents = file.readAll();
-        writer->writeTextElement(CONTENTS_TOKEN, contents.toBase64());
+        // The encoded file is written straight to the device, a chunk at a time
+        // (so first ensure that the start tag has been completed).
+        writer->writeStartElement(CONTENTS_TOKEN);
+        writer->writeCharacters(QString());
+        if (!ctx.writeAssetContents(writer->device(), contents.absoluteFilePath()))
+            ctx.fail(tr("Failed to read file: %1").arg(contents.absoluteFilePath()));
+        writer->writeEndElement();
 
         //writer->writeTextElement("thumbnail", thumbnail.toBase64());
         //writer->writeTextElement("summary", thing.toBase64());
@@ -308,33 +339,27 @@ void RWSnippet::write_asset(QXmlStreamWriter *writer, const QVariant &asset) con
     }
     else if (url.isValid())
     {
-        static QNetworkAccessManager *nam = nullptr;
-        if (nam == nullptr)
-        {
-            nam = new QNetworkAccessManager;
-            nam->setRedirectPolicy(QNetworkRequest::NoLessSafeRedirectPolicy);
-        }
-        QNetworkRequest request(url);
-        QNetworkReply *reply = nam->get(request);
-        while (!reply->isFinished())
-        {
-            qApp->processEvents(QEventLoop::WaitForMoreEvents);
-        }
-        if (reply->error() != QNetworkReply::NoError)
+        // URLs are normally all fetched before the topics are generated (see UrlAssetFetcher)
+        const UrlAssetFetcher::Result reply = ctx.urlAssets().result(url);
+        if (!reply.ok)
         {
-            qWarning() << "Failed to locate URL:" << asset.toString();
+            ctx.addMessage("Failed to locate URL: " + asset.toString());
         }
         // A redirect has ContentType of "text/html; charset=UTF-8, image/png"
         // which is an ordered comma-separated list of types.
         // So we need to check the LAST type which will be for readAll()
-        else if (reply->header(QNetworkRequest::ContentTypeHeader).toString().split(',').last().trimmed().startsWith("image/"))
+        else if (reply.content_type.split(',').last().trimmed().startsWith("image/"))
         {
-            QString tempname = QFileInfo(url.path()).baseName() + '.' + reply->header(QNetworkRequest::ContentTypeHeader).toString().split("/").last();
+            QString tempname = QFileInfo(url.path()).baseName() + '.' + reply.content_type.split("/").last();
             writer->writeStartElement("asset");
             writer->writeAttribute("filename", tempname.right(FILENAME_TYPE_LENGTH));
 
-            QByteArray contents = reply->readAll();
-            writer->writeTextElement(CONTENTS_TOKEN, contents.toBase64());
+            // Written a chunk at a time, the same as files (see above)
+            writer->writeStartElement(CONTENTS_TOKEN);
+            writer->writeCharacters(QString());
+            if (!ctx.urlAssets().writeContents(url, writer->device()))
+                ctx.fail(tr("Failed to read URL: %1").arg(asset.toString()));
+            writer->writeEndElement();
             //writer->writeTextElement("url", filename);
 
             writer->writeEndElement();   // asset
@@ -346,17 +371,14 @@ void RWSnippet::write_asset(QXmlStreamWriter *writer, const QVariant &asset) con
             // the body of the message is actually PNG binary data.
             // QPair("Server","Microsoft-IIS/8.5, Microsoft-IIS/8.5") so maybe ISS sent wrong content type
 
-            qWarning() << "Only URLs to images are supported (not" << reply->header(QNetworkRequest::ContentTypeHeader) << ")! Check source at" << asset.toString();
-            //if (reply->header(QNetworkRequest::ContentTypeHeader).toString().startsWith("text/"))
-            //    qWarning() << "Body =" << reply->readAll();
-            //qWarning() << "Raw Header List =" << reply->rawHeaderPairs();
+            ctx.addMessage(QString("Only URLs to images are supported (not %1)! Check source at %2")
+                           .arg(reply.content_type).arg(asset.toString()));
         }
-        reply->deleteLater();
     }
     else
     {
 #if 1
-        qWarning() << "File/URL does not exist:" + asset.toString();
+        ctx.addMessage("File/URL does not exist: " + asset.toString());
 #else
         QString message = "File/URL does not exist: " + asset.toString();
         static QMessageBox *warning = nullptr;
@@ -377,7 +399,7 @@ void RWSnippet::write_asset(QXmlStreamWriter *writer, const QVariant &asset) con
  * @param exttype one of Foreign, Statblock, Portfolio, Picture, Rich_Text, PDF, Audio, Video, HTML
  * @param filename
  */
-void RWSnippet::write_ext_object(QXmlStreamWriter *writer, const QString &exttype, const QVariant &asset) const
+void RWSnippet::write_ext_object(QXmlStreamWriter *writer, const ExportContext &ctx, const QString &exttype, const QVariant &asset) const
 {
     if (asset.isNull()) return;
     writer->writeStartElement("ext_object");
@@ -388,16 +410,16 @@ void RWSnippet::write_ext_object(QXmlStreamWriter *writer, const QString &exttyp
         writer->writeAttribute("name", DEFAULT_IMAGE_NAME.right(NAME_TYPE_LENGTH));
 
     writer->writeAttribute("type", exttype);
-    write_asset(writer, asset);
+    write_asset(writer, ctx, asset, /*is_picture*/ exttype == "Picture");
     writer->writeEndElement();
 }
 
-void RWSnippet::write_smart_image(QXmlStreamWriter *writer, const QVariant &asset) const
+void RWSnippet::write_smart_image(QXmlStreamWriter *writer, const ExportContext &ctx, const QVariant &asset) const
 {
     if (asset.isNull()) return;
     writer->writeStartElement("smart_image");
     writer->writeAttribute("name", QFileInfo(asset.toString()).fileName().right(NAME_TYPE_LENGTH));
-    write_asset(writer, asset);
+    write_asset(writer, ctx, asset, /*is_picture*/ true);
     // write_overlay (0-1)
     // write_subset_mask (0-1)
     // write_superset_mask (0-1)
@@ -30,7 +30,7 @@ class RWSnippet : public RWContentsItem
 
 public:
     RWSnippet(RWFacet *item, RWContentsItem *parent);
-    virtual void writeToContents(QXmlStreamWriter*, const QModelIndex &index) const;
+    virtual void writeToContents(QXmlStreamWriter*, const ExportContext &ctx, const QModelIndex &index) const;
 
     DataField &tags()      { return p_tags; }
     DataField &labelText() { return p_label_text; }
@@ -48,12 +48,16 @@ public:
 
     const RWFacet *const facet;
 
+    // Checking the format of the dates in Date_Game and Date_Range snippets
+    static bool isValidDate(const QString &date);
+    static QString invalidDateMessage(const QString &date);
+
 public slots:
 
 private:
-    void write_asset(QXmlStreamWriter *writer, const QVariant &filename) const;
-    void write_ext_object(QXmlStreamWriter *writer, const QString &exttype, const QVariant &filename) const;
-    void write_smart_image(QXmlStreamWriter *writer, const QVariant &filename) const;
+    void write_asset(QXmlStreamWriter *writer, const ExportContext &ctx, const QVariant &filename, bool is_picture = false) const;
+    void write_ext_object(QXmlStreamWriter *writer, const ExportContext &ctx, const QString &exttype, const QVariant &filename) const;
+    void write_smart_image(QXmlStreamWriter *writer, const ExportContext &ctx, const QVariant &filename) const;
     DataField p_tags;
     DataField p_label_text;   // for Labeled_Text fields
     DataField p_filename;
@@ -23,21 +23,18 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "rw_topic.h"
 #include "rw_partition.h"
 #include "rw_relationship.h"
-#include "errordialog.h"
 #include "realmworksstructure.h"
+#include "exportcontext.h"
 
 #include <QXmlStreamWriter>
 #include <QMetaEnum>
 #include <QModelIndex>
 #include <QDebug>
 #include <QDataStream>
-#include <QCoreApplication>
 
 #include "rw_contents_item.h"   // TODO - remove this?
 
-static int base_topic_id = 1000;
 static QString g_default_name = "no-name";
-static QSet<QString> generated_topics;
 
 RWTopic::RWTopic(RWCategory *item, RWContentsItem *parent) :
     RWContentsItem(item, parent),
@@ -46,19 +43,6 @@ RWTopic::RWTopic(RWCategory *item, RWContentsItem *parent) :
 {
 }
 
-/**
- * @brief RWTopic::setBaseTopicId
- * @param value
- * This should be called before each new export.
- * Sets the base topic id to be used for topics which are not directly created from a row in the source model.
- */
-void RWTopic::initBeforeExport(int model_row_count)
-{
-    generated_topics.clear();
-    base_topic_id = model_row_count + 10;
-    ErrorDialog::theInstance()->clear();
-}
-
 /**
  * @brief RWTopic::canBeGenerated
  * @return true if a model index has been set on the modelValueForName
@@ -70,46 +54,60 @@ bool RWTopic::canBeGenerated() const
     //return p_name.namefield().modelColumn() >= 0 && RWBaseItem::canBeGenerated();
 }
 
-void RWTopic::writeToContents(QXmlStreamWriter *writer, const QModelIndex &index, bool use_index_topic_id) const
+/**
+ * @brief RWTopic::writeToContents
+ * @param writer
+ * @param ctx the export being generated
+ * @param index
+ * @param use_index_topic_id
+ * @param deferred_check If not null, then the topic is added to this list rather than being passed
+ * to ExportContext::checkGeneratedTopic (so that topics generated in other threads can be checked in a predictable order).
+ * @return true if a topic was written
+ */
+bool RWTopic::writeToContents(QXmlStreamWriter *writer, const ExportContext &ctx, const QModelIndex &index, bool use_index_topic_id, GeneratedTopics *deferred_check) const
 {
     // Don't put topics into the file if they don't match the filter
     if (keyColumn() < 0 || index.sibling(index.row(), keyColumn()).data().toString() == keyValue())
     {
-        writeStartToContents(writer, index, use_index_topic_id);
+        writeStartToContents(writer, ctx, index, use_index_topic_id, deferred_check);
         writer->writeEndElement();  // </topic>
+        return true;
     }
+    return false;
 }
 
 
-void RWTopic::writeStartToContents(QXmlStreamWriter *writer, const QModelIndex &index, bool use_index_topic_id) const
+void RWTopic::writeStartToContents(QXmlStreamWriter *writer, const ExportContext &ctx, const QModelIndex &index, bool use_index_topic_id, GeneratedTopics *deferred_check) const
 {
     writer->writeStartElement("topic");
     {
         // Use model row for an explicit topic, otherwise allocate a "random" topic id
+        // (body topics might be generated in any order, so their IDs must only depend on the row)
+        QString public_name = ctx.valueString(p_public_name.namefield(), index);
+
         QString topic_id;
         if (use_index_topic_id && p_public_name.namefield().modelColumn() >= 0)
         {
-            topic_id = index.data(Qt::UserRole).toString();
+            topic_id = ctx.rowTopicId(index);
         }
+        else if (use_index_topic_id)
+            topic_id = QString("%1_%2").arg(ctx.rowTopicId(index)).arg(category->id());
         else
-            topic_id = QString("topic_%1").arg(base_topic_id++);
-
-        QString public_name = p_public_name.namefield().valueString(index);
+            topic_id = ctx.allocateTopicId(category->id() + '/' + public_name);
 
         if (public_name.isEmpty())
             public_name = g_default_name;
-        else if (generated_topics.contains(topic_id))
-            // Report the duplicate name
-            ErrorDialog::theInstance()->addMessage(tr("Topic '%1' appears in output more than once (the import will fail).").arg(public_name));
+        else if (deferred_check)
+            deferred_check->append(qMakePair(topic_id, public_name));
         else
-            generated_topics.insert(topic_id);
+            ctx.checkGeneratedTopic(topic_id, public_name);
 
         writer->writeAttribute("topic_id", topic_id);
         if (!category->id().isEmpty()) writer->writeAttribute("category_id", category->id());
         writer->writeAttribute("public_name", public_name);
-        QString prefix = p_prefix.valueString(index);
+        QString prefix = ctx.valueString(p_prefix, index);
         if (!prefix.isEmpty()) writer->writeAttribute("prefix", prefix);
-        QString suffix = p_suffix.valueString(index);
+        QString suffix = ctx.valueString(p_suffix, index);
         if (!suffix.isEmpty()) writer->writeAttribute("suffix", suffix);
         p_public_name.writeAttributes(writer, index);
         if (isRevealed()) writer->writeAttribute("is_revealed", "true");
@@ -119,20 +117,21 @@ void RWTopic::writeStartToContents(QXmlStreamWriter *writer, const QModelIndex &
         // This allows a user to specify several different aliases in the GUI each using a different set of attributes,
         // and then use a different data column for each particular alias.
         // (Ensure that all aliases are different, and also different from the topic's main title
+        // (Alias IDs are derived from the topic ID, so that they don't depend on the order in which topics are generated.)
         QStringList known_names(public_name);
         for (auto alias: aliases)
         {
-            QString name = alias->namefield().valueString(index);
+            QString name = ctx.valueString(alias->namefield(), index);
             if (name.isEmpty()) continue;
             if (!known_names.contains(name))
             {
-                alias->writeToContents(writer, index);
+                alias->writeToContents(writer, ctx, index, QString("Alias_%1_%2").arg(topic_id).arg(known_names.size()));
                 known_names.append(name);
             }
             else if (name == public_name)
-                ErrorDialog::theInstance()->addMessage(tr("Can't create alias with same name as topic: '%1'").arg(name));
+                ctx.addMessage(tr("Can't create alias with same name as topic: '%1'").arg(name));
             else
-                ErrorDialog::theInstance()->addMessage(tr("Same alias '%1' appears more than once in topic '%2'").arg(name).arg(public_name));
+                ctx.addMessage(tr("Same alias '%1' appears more than once in topic '%2'").arg(name).arg(public_name));
         }
 
         // Children in the following order:
@@ -141,14 +140,14 @@ void RWTopic::writeStartToContents(QXmlStreamWriter *writer, const QModelIndex &
         //   X x 'tag_assign'
         //   X x connection / dconnection
         //   X x 'topic'
-        writeChildrenToContents(writer, index);   // this will do sections
+        writeChildrenToContents(writer, ctx, index);   // this will do sections
 
         // Relevant export tag on every topic
         writeExportTag(writer);
 
         // All possible relationships
         for (auto relationship: relationships)
-            relationship->writeToContents(writer, index);
+            relationship->writeToContents(writer, ctx, index);
 
         // No actual TEXT for this element (only children)
         //if (!text().valueString(index).isEmpty()) writer->writeCharacters(text().valueString(index));
@@ -216,28 +215,33 @@ QDataStream& operator<<(QDataStream &stream, const RWTopic &topic)
     return stream;
 }
 
-QDataStream& operator>>(QDataStream &stream, RWTopic &topic)
+/**
+ * @brief RWTopic::loadState
+ * Reads the field mappings of the topic, as written by operator<<.
+ * @param stream
+ * @param save_version the version of the project file being read (see ProjectFile)
+ */
+void RWTopic::loadState(QDataStream &stream, int save_version)
 {
     int count;
-    int save_version = qApp->property("saveVersion").toInt();
 
-    //qDebug() << "RWTopic>>" << topic.structure->name();
+    //qDebug() << "RWTopic::loadState" << structure->name();
     // Collect the structure->name() of each child into a look-up table
     QMap<QString,RWContentsItem*> contents;
-    for (auto child: topic.findChildren<RWContentsItem*>())
+    for (auto child: findChildren<RWContentsItem*>())
     {
         QString mapname{QString("%1:%2").arg(child->metaObject()->className()).arg(child->structure->name())};
         contents.insert(mapname, child);
     }
 
     // read base class items
-    stream >> *dynamic_cast<RWContentsItem*>(&topic);
+    stream >> *dynamic_cast<RWContentsItem*>(this);
     // read this class items
-    stream >> topic.p_public_name.namefield();
-    stream >> topic.p_prefix;
-    stream >> topic.p_suffix;
-    stream >> topic.p_key_column;
-    stream >> topic.p_key_value;
+    stream >> p_public_name.namefield();
+    stream >> p_prefix;
+    stream >> p_suffix;
+    stream >> p_key_column;
+    stream >> p_key_value;
 
     // read name aliases (only present from app version 2.9 and later)
     if (save_version >= 0x0209)
@@ -248,7 +252,7 @@ QDataStream& operator>>(QDataStream &stream, RWTopic &topic)
         {
             RWAlias *alias = new RWAlias;
             stream >> *alias;
-            topic.aliases.append(alias);
+            aliases.append(alias);
         }
     }
 
@@ -264,9 +268,9 @@ QDataStream& operator>>(QDataStream &stream, RWTopic &topic)
         RWContentsItem* elem = contents.value(classname + ":" + name, nullptr);
         if (elem == nullptr)
         {
-            qWarning() << "RWTopic>> failed to find RWContentsItem for" << classname + ":" + name;
+            qWarning() << "RWTopic::loadState failed to find RWContentsItem for" << classname + ":" + name;
             stream.setStatus(QDataStream::ReadCorruptData);
-            return stream;
+            return;
         }
 
         // Use correct reader
@@ -284,7 +288,7 @@ QDataStream& operator>>(QDataStream &stream, RWTopic &topic)
     {
         RWRelationship *relationship = new RWRelationship;
         stream >> *relationship;
-        topic.relationships.append(relationship);
+        relationships.append(relationship);
     }
 
     // read parents (they won't have children!)
@@ -296,7 +300,7 @@ QDataStream& operator>>(QDataStream &stream, RWTopic &topic)
         stream >> category_name;
 
         RWCategory *new_category = nullptr;
-        for (auto category: RealmWorksStructure::theInstance()->categories)
+        for (auto category: RealmWorksStructure::owner(this->category)->categories)
         {
             if (category->name() == category_name)
             {
@@ -304,7 +308,7 @@ QDataStream& operator>>(QDataStream &stream, RWTopic &topic)
                 break;
             }
         }
-        if (new_category == nullptr) return stream;
+        if (new_category == nullptr) return;
         RWTopic *parent = qobject_cast<RWTopic*>(new_category->createContentsTree());
 
         stream >> *dynamic_cast<RWContentsItem*>(parent);
@@ -314,7 +318,6 @@ QDataStream& operator>>(QDataStream &stream, RWTopic &topic)
         stream >> parent->p_suffix;
         stream >> parent->p_key_column;
         stream >> parent->p_key_value;
-        topic.parents.append(parent);
+        parents.append(parent);
     }
-    return stream;
 }
@@ -21,6 +21,8 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "rw_contents_item.h"
 #include "rw_alias.h"
+#include <QPair>
+#include <QVector>
 
 class QDataStream;
 class QXmlStreamWriter;
@@ -36,11 +38,19 @@ class RWTopic : public RWContentsItem
 public:
     RWTopic(RWCategory *item, RWContentsItem *parent);
 
-    virtual void writeToContents(QXmlStreamWriter*, const QModelIndex &index, bool use_index_topic_id) const;
-    virtual void writeStartToContents(QXmlStreamWriter*, const QModelIndex &index, bool use_index_topic_id) const;
+    // (topic_id, public_name) of each topic written, when the duplicate check is to be done later
+    typedef QVector<QPair<QString,QString>> GeneratedTopics;
+
+    virtual bool writeToContents(QXmlStreamWriter*, const ExportContext &ctx, const QModelIndex &index, bool use_index_topic_id,
+                                 GeneratedTopics *deferred_check = nullptr) const;
+    virtual void writeStartToContents(QXmlStreamWriter*, const ExportContext &ctx, const QModelIndex &index, bool use_index_topic_id,
+                                      GeneratedTopics *deferred_check = nullptr) const;
 
     virtual bool canBeGenerated() const;
 
+    // Reads what operator<< writes (the format depends on the version of the project file)
+    void loadState(QDataStream &stream, int save_version);
+
     QList<RWAlias*> aliases;
     const RWCategory *const category;
 
@@ -49,11 +59,11 @@ public:
 
 public:
     RWAlias &publicName() { return p_public_name; }
+    const RWAlias &publicName() const { return p_public_name; }
     DataField &prefix()  { return p_prefix; }
     DataField &suffix()  { return p_suffix; }
 
     static void setDefaultName(const QString &name);
-    static void initBeforeExport(int model_row_count);
     int keyColumn() const { return p_key_column; }
     QString keyValue() const { return p_key_column >= 0 ? p_key_value : QString(); }
 
@@ -71,10 +81,8 @@ private:
     int p_key_column;
     QString p_key_value;
     friend QDataStream& operator<<(QDataStream&, const RWTopic&);
-    friend QDataStream& operator>>(QDataStream&, RWTopic&);
 };
 
 extern QDataStream& operator<<(QDataStream&, const RWTopic&);
-extern QDataStream& operator>>(QDataStream&, RWTopic&);
 
 #endif // RW_TOPIC_H
@@ -40,6 +40,7 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "rw_alias.h"
 #include "rw_category.h"
 #include "rw_domain.h"
+#include "realmworksstructure.h"
 #include "rw_facet.h"
 #include "rw_partition.h"
 #include "rw_section.h"
@@ -485,7 +486,7 @@ QWidget *RWTopicWidget::add_snippet(QAbstractItemModel *columns, RWSnippet *snip
     if (facet->snippetType() == RWFacet::Hybrid_Tag ||
         facet->snippetType() == RWFacet::Tag_Standard )
     {
-        combo = new FieldComboBox(snippet->tags(), RWDomain::getDomainById(facet->attributes().value("domain_id").toString()));
+        combo = new FieldComboBox(snippet->tags(), RealmWorksStructure::owner(facet)->domainById(facet->attributes().value("domain_id").toString()));
         if (snippet->tags().modelColumn() >= 0)
             combo->setIndexString(column_name(columns, snippet->tags().modelColumn()));
     }
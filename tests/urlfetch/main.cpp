@@ -0,0 +1,274 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QAtomicInt>
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QRandomGenerator>
+#include <QSemaphore>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+#include <thread>
+
+#include "base64encoder.h"
+#include "urlassetfetcher.h"
+
+static QTextStream out(stdout);
+static int failures = 0;
+
+static void check(bool ok, const QString &what)
+{
+    out << (ok ? "ok    " : "FAIL  ") << what << endl;
+    if (!ok) failures++;
+}
+
+// How long the server takes to answer /slow
+static const int SLOW_DELAY = 2000;
+
+/**
+ * @brief The TestServer class
+ * A minimal HTTP server, running in its own thread, which answers each request on a new connection:
+ *
+ *     /image.png   200 with an ETag (or 304 if the request has a matching If-None-Match)
+ *     /large.png   200 with a body larger than one chunk of Base64Encoder
+ *     /redirect    302 to /image.png
+ *     /missing     404
+ *     /broken      500
+ *     /slow        200 after SLOW_DELAY ms
+ */
+class TestServer : public QThread
+{
+public:
+    TestServer()
+    {
+        image = QByteArray("\x89PNG\r\n\x1a\n", 8) + random(1000);
+        large = random(Base64Encoder::CHUNK_SIZE * 3 + 1);
+    }
+
+    bool startListening()
+    {
+        start();
+        listening.acquire();
+        return p_port != 0;
+    }
+
+    QUrl url(const QString &path) const
+    {
+        return QUrl(QString("http://127.0.0.1:%1%2").arg(p_port).arg(path));
+    }
+
+    int requests(const QString &path)
+    {
+        QMutexLocker lock(&mutex);
+        return counts.value(path);
+    }
+
+    int conditionalRequests(const QString &path)
+    {
+        QMutexLocker lock(&mutex);
+        return conditional_counts.value(path);
+    }
+
+    QByteArray image;
+    QByteArray large;
+
+protected:
+    void run() override
+    {
+        QTcpServer server;
+        if (server.listen(QHostAddress::LocalHost)) p_port = server.serverPort();
+        QObject::connect(&server, &QTcpServer::newConnection, [this, &server]() {
+            while (QTcpSocket *socket = server.nextPendingConnection())
+            {
+                QObject::connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+                QObject::connect(socket, &QTcpSocket::readyRead, socket, [this, socket]() {
+                    if (socket->property("answered").toBool()) return;
+                    const QByteArray request = socket->property("request").toByteArray() + socket->readAll();
+                    socket->setProperty("request", request);
+                    const int end = request.indexOf("\r\n\r\n");
+                    if (end < 0) return;
+                    socket->setProperty("answered", true);
+                    respond(socket, request.left(end));
+                });
+            }
+        });
+        listening.release();
+        if (p_port != 0) exec();
+    }
+
+private:
+    QSemaphore listening;
+    quint16 p_port{0};
+    QMutex mutex;
+    QHash<QString,int> counts;
+    QHash<QString,int> conditional_counts;
+
+    static QByteArray random(int size)
+    {
+        QByteArray result(size, Qt::Uninitialized);
+        for (char &byte : result) byte = char(QRandomGenerator::global()->bounded(256));
+        return result;
+    }
+
+    static void send(QTcpSocket *socket, const QByteArray &status, const QByteArray &headers, const QByteArray &body)
+    {
+        socket->write("HTTP/1.1 " + status + "\r\n" +
+                      "Content-Length: " + QByteArray::number(body.size()) + "\r\n" +
+                      "Connection: close\r\n" +
+                      headers + "\r\n" + body);
+        socket->disconnectFromHost();
+    }
+
+    void respond(QTcpSocket *socket, const QByteArray &request)
+    {
+        const QString path = QString::fromLatin1(request.left(request.indexOf("\r\n")).split(' ').value(1));
+        const bool conditional = request.toLower().contains("\r\nif-none-match: \"v1\"");
+        {
+            QMutexLocker lock(&mutex);
+            counts[path]++;
+            if (conditional) conditional_counts[path]++;
+        }
+
+        const QByteArray image_headers = "Content-Type: image/png\r\nETag: \"v1\"\r\nCache-Control: no-cache\r\n";
+        if (path == "/image.png")
+        {
+            if (conditional)
+                send(socket, "304 Not Modified", "ETag: \"v1\"\r\nCache-Control: no-cache\r\n", QByteArray());
+            else
+                send(socket, "200 OK", image_headers, image);
+        }
+        else if (path == "/large.png")
+            send(socket, "200 OK", "Content-Type: image/png\r\n", large);
+        else if (path == "/redirect")
+            send(socket, "302 Found", "Location: " + url("/image.png").toEncoded() + "\r\n", QByteArray());
+        else if (path == "/broken")
+            send(socket, "500 Internal Server Error", "Content-Type: text/plain\r\n", "broken");
+        else if (path == "/slow")
+            QTimer::singleShot(SLOW_DELAY, socket, [socket, image_headers, this]() {
+                send(socket, "200 OK", image_headers, image);
+            });
+        else
+            send(socket, "404 Not Found", "Content-Type: text/plain\r\n", "missing");
+    }
+};
+
+static QByteArray contents(UrlAssetFetcher &fetcher, const QUrl &url)
+{
+    QByteArray encoded;
+    QBuffer buffer(&encoded);
+    buffer.open(QIODevice::WriteOnly);
+    if (!fetcher.writeContents(url, &buffer)) return QByteArray();
+    return QByteArray::fromBase64(encoded);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    TestServer server;
+    if (!server.startListening())
+    {
+        out << "Failed to start the local HTTP server" << endl;
+        return 1;
+    }
+    QTemporaryDir cache_directory;
+
+    // A first fetch downloads everything
+    {
+        UrlAssetFetcher fetcher(cache_directory.path());
+        const QList<QUrl> urls{ server.url("/image.png"), server.url("/large.png"),
+                    server.url("/missing"), server.url("/broken"), server.url("/image.png") };
+        check(fetcher.fetch(urls) == 0, "first fetch isn't from the disk cache");
+        check(server.requests("/image.png") == 1 && server.requests("/missing") == 1, "each URL requested once");
+
+        UrlAssetFetcher::Result image = fetcher.result(server.url("/image.png"));
+        check(image.ok && image.content_type == "image/png", "image fetched");
+        check(contents(fetcher, server.url("/image.png")) == server.image, "image contents");
+        check(contents(fetcher, server.url("/large.png")) == server.large, "contents larger than one chunk");
+
+        UrlAssetFetcher::Result redirect = fetcher.result(server.url("/redirect"));
+        check(redirect.ok && redirect.content_type.split(',').last().trimmed() == "image/png", "redirect followed");
+        check(contents(fetcher, server.url("/redirect")) == server.image, "redirect contents");
+
+        UrlAssetFetcher::Result missing = fetcher.result(server.url("/missing"));
+        check(!missing.ok && !missing.error.isEmpty(), "404 reported as an error");
+        UrlAssetFetcher::Result broken = fetcher.result(server.url("/broken"));
+        check(!broken.ok && !broken.error.isEmpty(), "500 reported as an error");
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        check(!fetcher.writeContents(server.url("/missing"), &buffer) && buffer.size() == 0, "no contents for an error");
+
+        // Nothing is requested again by the same fetcher
+        const int image_requests = server.requests("/image.png");
+        const int missing_requests = server.requests("/missing");
+        fetcher.fetch(urls);
+        fetcher.result(server.url("/image.png"));
+        fetcher.result(server.url("/missing"));
+        check(server.requests("/image.png") == image_requests && server.requests("/missing") == missing_requests,
+              "responses reused by the same fetcher");
+    }
+
+    // A new fetcher only checks that the cached image is still valid
+    {
+        UrlAssetFetcher fetcher(cache_directory.path());
+        const int conditional = server.conditionalRequests("/image.png");
+        check(fetcher.fetch(QList<QUrl>{server.url("/image.png")}) == 1, "image fetched from the disk cache");
+        check(server.conditionalRequests("/image.png") == conditional + 1, "cached image revalidated with the server");
+        check(contents(fetcher, server.url("/image.png")) == server.image, "cached image contents");
+    }
+
+    // A URL which is being downloaded is only requested once, and doesn't stop other URLs being read
+    {
+        UrlAssetFetcher fetcher(cache_directory.path());
+        fetcher.fetch(QList<QUrl>{server.url("/image.png")});
+
+        QAtomicInt slow_finished;
+        UrlAssetFetcher::Result slow_results[2];
+        auto fetch_slow = [&](int which) {
+            slow_results[which] = fetcher.result(server.url("/slow"));
+            slow_finished.ref();
+        };
+        std::thread first(fetch_slow, 0);
+        QElapsedTimer timer;
+        timer.start();
+        while (server.requests("/slow") == 0 && timer.elapsed() < SLOW_DELAY) QThread::msleep(10);
+        std::thread second(fetch_slow, 1);
+
+        const bool image_ok = fetcher.result(server.url("/image.png")).ok &&
+                contents(fetcher, server.url("/image.png")) == server.image;
+        check(image_ok && slow_finished.load() == 0, "cached URL read during another download");
+
+        first.join();
+        second.join();
+        check(slow_results[0].ok && slow_results[1].ok, "slow URL fetched by both threads");
+        check(server.requests("/slow") == 1, "slow URL only requested once");
+    }
+
+    server.quit();
+    server.wait();
+
+    out << (failures == 0 ? "All checks passed" : QString("%1 checks failed").arg(failures)) << endl;
+    return failures == 0 ? 0 : 1;
+}
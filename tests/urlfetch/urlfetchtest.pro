@@ -0,0 +1,24 @@
+# Test of UrlAssetFetcher against a local HTTP server:
+#
+#     urlfetchtest
+#
+# Checks that responses are reused (within a fetcher, and through the disk cache by a new fetcher),
+# that redirects are followed, that errors are reported, that a URL requested by several threads is only
+# downloaded once, and that cached URLs can be read while another URL is still being downloaded.
+# It exits with status 1 if any of the checks fails.
+
+QT       = core network
+CONFIG  += console c++11
+CONFIG  -= app_bundle
+
+TARGET   = urlfetchtest
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += main.cpp \
+    ../../base64encoder.cpp \
+    ../../urlassetfetcher.cpp
+
+HEADERS += ../../base64encoder.h \
+    ../../urlassetfetcher.h
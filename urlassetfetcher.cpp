@@ -0,0 +1,272 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "urlassetfetcher.h"
+#include "base64encoder.h"
+
+#include <QBuffer>
+#include <QDebug>
+#include <QEventLoop>
+#include <QNetworkAccessManager>
+#include <QNetworkDiskCache>
+#include <QNetworkReply>
+#include <QStandardPaths>
+#include <QTemporaryFile>
+#include <functional>
+
+/**
+ * @brief UrlAssetFetcher::UrlAssetFetcher
+ * @param cache_directory where responses are kept between runs (no disk cache is used if it is empty)
+ * @param max_concurrent the maximum number of requests in progress at once
+ */
+UrlAssetFetcher::UrlAssetFetcher(const QString &cache_directory, int max_concurrent) :
+    p_cache_directory(cache_directory),
+    p_max_concurrent(qMax(1, max_concurrent))
+{
+}
+
+UrlAssetFetcher::~UrlAssetFetcher()
+{
+    delete spill_file;
+}
+
+/**
+ * @brief UrlAssetFetcher::defaultCacheDirectory
+ * @return the directory used for the disk cache unless another is specified.
+ */
+QString UrlAssetFetcher::defaultCacheDirectory()
+{
+    QString location = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    return location.isEmpty() ? location : location + "/assets";
+}
+
+/**
+ * @brief UrlAssetFetcher::isRemote
+ * @param url
+ * @return true if the URL refers to something on a server (rather than a local file)
+ */
+bool UrlAssetFetcher::isRemote(const QUrl &url)
+{
+    const QString scheme = url.scheme().toLower();
+    return scheme == "http" || scheme == "https" || scheme == "ftp";
+}
+
+/**
+ * @brief UrlAssetFetcher::store
+ * Puts the body of a response into the spill file (or keeps it in memory if that isn't possible).
+ */
+void UrlAssetFetcher::store(Entry *entry, const QByteArray &body)
+{
+    QMutexLocker lock(&spill_mutex);
+    if (spill_file == nullptr)
+    {
+        spill_file = new QTemporaryFile;
+        if (!spill_file->open())
+            qWarning().noquote() << QObject::tr("Failed to create temporary file for URL assets: %1").arg(spill_file->errorString());
+    }
+    if (spill_file->isOpen() && spill_file->seek(spill_file->size()))
+    {
+        entry->spill_offset = spill_file->pos();
+        entry->spill_length = spill_file->write(body);
+        if (entry->spill_length == body.size()) return;
+    }
+    entry->spill_offset = -1;
+    entry->data = body;
+}
+
+/**
+ * @brief UrlAssetFetcher::fetch
+ * Downloads each of the URLs which hasn't already been fetched, with up to max_concurrent requests
+ * in progress at once. This returns once every request has finished (successfully or not),
+ * including those for any of the URLs which were already being downloaded by another thread.
+ * It runs its own event loop, so it can be called from any thread.
+ * @param urls
+ * @return the number of the URLs which were fetched from the disk cache by this call
+ */
+int UrlAssetFetcher::fetch(const QList<QUrl> &urls)
+{
+    // An entry which isn't done yet marks a URL which is being downloaded,
+    // so each URL is only claimed by one call.
+    QList<QUrl> pending;
+    QList<QUrl> in_progress;
+    {
+        QMutexLocker lock(&mutex);
+        for (const QUrl &url : urls)
+        {
+            auto it = entries.constFind(url);
+            if (it == entries.constEnd())
+            {
+                entries.insert(url, Entry());
+                pending.append(url);
+            }
+            else if (!it->done)
+                in_progress.append(url);
+        }
+    }
+
+    const int cache_hits = pending.isEmpty() ? 0 : download(pending);
+
+    QMutexLocker lock(&mutex);
+    for (const QUrl &url : in_progress)
+    {
+        while (!entries.constFind(url)->done) fetched.wait(&mutex);
+    }
+    return cache_hits;
+}
+
+/**
+ * @brief UrlAssetFetcher::download
+ * Downloads the URLs claimed by fetch, storing each response as soon as it has finished.
+ * @param urls
+ * @return the number of the URLs which were fetched from the disk cache
+ */
+int UrlAssetFetcher::download(const QList<QUrl> &urls)
+{
+    QMutexLocker download_lock(&download_mutex);
+
+    QNetworkAccessManager nam;
+    nam.setRedirectPolicy(QNetworkRequest::NoLessSafeRedirectPolicy);
+    if (!p_cache_directory.isEmpty())
+    {
+        // The manager takes ownership of the cache
+        QNetworkDiskCache *cache = new QNetworkDiskCache;
+        cache->setCacheDirectory(p_cache_directory);
+        cache->setMaximumCacheSize(DISK_CACHE_SIZE);
+        nam.setCache(cache);
+    }
+
+    QEventLoop loop;
+    int next = 0;
+    int active = 0;
+    int cache_hits = 0;
+    std::function<void()> start_requests;
+
+    auto finished = [&](QNetworkReply *reply, const QUrl &url)
+    {
+        if (reply->attribute(QNetworkRequest::SourceIsFromCacheAttribute).toBool()) cache_hits++;
+        Entry entry;
+        entry.done = true;
+        entry.result.ok = (reply->error() == QNetworkReply::NoError);
+        if (entry.result.ok)
+        {
+            entry.result.content_type = reply->header(QNetworkRequest::ContentTypeHeader).toString();
+            store(&entry, reply->readAll());
+        }
+        else
+            entry.result.error = reply->errorString();
+        reply->deleteLater();
+
+        QMutexLocker lock(&mutex);
+        entries.insert(url, entry);
+        fetched.wakeAll();
+    };
+
+    start_requests = [&]()
+    {
+        while (active < p_max_concurrent && next < urls.size())
+        {
+            const QUrl url = urls.at(next++);
+            QNetworkRequest request(url);
+            // Ask the server whether the cached copy (if any) is still valid, rather than downloading it again
+            request.setAttribute(QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferNetwork);
+            QNetworkReply *reply = nam.get(request);
+            if (reply->isFinished())
+            {
+                finished(reply, url);
+                continue;
+            }
+            active++;
+            QObject::connect(reply, &QNetworkReply::finished, &loop, [&, reply, url]() {
+                finished(reply, url);
+                active--;
+                start_requests();
+                if (active == 0) loop.quit();
+            });
+        }
+    };
+
+    start_requests();
+    if (active > 0) loop.exec();
+    return cache_hits;
+}
+
+/**
+ * @brief UrlAssetFetcher::result
+ * @param url
+ * @return the status of the response for the URL (which is fetched now if it wasn't included in an earlier call to fetch)
+ */
+UrlAssetFetcher::Result UrlAssetFetcher::result(const QUrl &url)
+{
+    QMutexLocker lock(&mutex);
+    for (;;)
+    {
+        auto it = entries.constFind(url);
+        if (it == entries.constEnd())
+        {
+            lock.unlock();
+            fetch(QList<QUrl>{url});
+            lock.relock();
+        }
+        else if (it->done)
+            return it->result;
+        else
+            fetched.wait(&mutex);
+    }
+}
+
+/**
+ * @brief UrlAssetFetcher::writeContents
+ * Writes the body of the response for the URL (which is fetched now if necessary) to the destination as base64,
+ * a chunk at a time, in the same way as the files in AssetCache.
+ * @param url
+ * @param destination
+ * @return false if there is no body for the URL, or it couldn't be read or written
+ */
+bool UrlAssetFetcher::writeContents(const QUrl &url, QIODevice *destination)
+{
+    if (!result(url).ok) return false;
+
+    Entry entry;
+    {
+        QMutexLocker lock(&mutex);
+        entry = entries.value(url);
+    }
+    if (entry.spill_offset < 0)
+    {
+        QBuffer buffer(&entry.data);
+        return buffer.open(QIODevice::ReadOnly) && Base64Encoder::encode(&buffer, destination);
+    }
+
+    // The spill file is shared, so it is only locked while each chunk is read.
+    Base64Encoder encoder;
+    for (qint64 done = 0; done < entry.spill_length; )
+    {
+        QByteArray chunk;
+        {
+            QMutexLocker lock(&spill_mutex);
+            if (!spill_file->seek(entry.spill_offset + done)) return false;
+            chunk = spill_file->read(qMin<qint64>(Base64Encoder::CHUNK_SIZE, entry.spill_length - done));
+        }
+        if (chunk.isEmpty()) return false;
+        done += chunk.size();
+        const QByteArray encoded = encoder.encode(chunk);
+        if (destination->write(encoded) != encoded.size()) return false;
+    }
+    const QByteArray encoded = encoder.finish();
+    return destination->write(encoded) == encoded.size();
+}
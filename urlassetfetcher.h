@@ -0,0 +1,96 @@
+#ifndef URLASSETFETCHER_H
+#define URLASSETFETCHER_H
+
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QUrl>
+#include <QWaitCondition>
+
+class QIODevice;
+class QTemporaryFile;
+
+/**
+ * @brief The UrlAssetFetcher class
+ * Downloads the assets which are given as URLs rather than file names.
+ *
+ * All the URLs used by an export are fetched before any topics are written, several at a time.
+ * Only the status of each response is kept in memory; the bodies are put into a temporary file
+ * until they are needed (see writeContents), so memory use doesn't depend on the number of assets.
+ * Responses are also kept in a disk cache which persists between runs, so a later export only needs to check
+ * (using ETag/Last-Modified) that each asset hasn't changed on the server.
+ *
+ * It can be used by several threads at once (e.g. one fetcher is shared by all the exports of a batch),
+ * and each URL is only fetched once. A thread which asks for a URL that is still being downloaded waits for it,
+ * but other URLs can be read while downloads are in progress.
+ */
+class UrlAssetFetcher
+{
+public:
+    explicit UrlAssetFetcher(const QString &cache_directory = defaultCacheDirectory(),
+                             int max_concurrent = DEFAULT_MAX_CONCURRENT);
+
+    ~UrlAssetFetcher();
+
+    struct Result
+    {
+        bool ok{false};
+        QString content_type;
+        QString error;
+    };
+    int fetch(const QList<QUrl> &urls);
+    Result result(const QUrl &url);
+    bool writeContents(const QUrl &url, QIODevice *destination);
+
+    static bool isRemote(const QUrl &url);
+    static QString defaultCacheDirectory();
+
+    static const int DEFAULT_MAX_CONCURRENT = 6;
+    static const qint64 DISK_CACHE_SIZE = 1024 * 1024 * 1024;
+
+private:
+    // Only held while the entries are read or updated, never during a download
+    QMutex mutex;
+    // Woken each time a download finishes
+    QWaitCondition fetched;
+    // Only one set of downloads is run at a time (the disk cache can't be shared between threads)
+    QMutex download_mutex;
+    struct Entry
+    {
+        Result result;
+        bool done{false};           // false while the URL is being downloaded
+        QByteArray data;            // only if it couldn't be put into the spill file
+        qint64 spill_offset{-1};
+        qint64 spill_length{0};
+    };
+    QHash<QUrl,Entry> entries;
+    int download(const QList<QUrl> &urls);
+    QMutex spill_mutex;
+    QTemporaryFile *spill_file{nullptr};
+    void store(Entry *entry, const QByteArray &body);
+    QString p_cache_directory;
+    int p_max_concurrent;
+    Q_DISABLE_COPY(UrlAssetFetcher)
+};
+
+#endif // URLASSETFETCHER_H
@@ -0,0 +1,100 @@
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "urllinks.h"
+#include <QScopedPointer>
+#include "regexp.h"
+
+/**
+ * @brief mayContainUrl
+ * @return false if the text certainly doesn't contain anything which matches url_regexp.
+ */
+bool mayContainUrl(const QStringRef &text)
+{
+    const int length = text.size();
+    for (int pos = 0; pos < length; pos++)
+    {
+        const QChar ch = text.at(pos);
+        if (ch == ':' || ch == '@' || (ch == 'w' && text.mid(pos, 4) == QLatin1String("www.")))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief append_link
+ * Appends a link to the URL, and then restarts the span of text with the current style.
+ */
+static void append_link(QString &result, const QStringRef &url, const QString &start_rwsnippet)
+{
+    result.append("<a class=\"RWLink\" style=\"color:#000000;text-decoration:none\" href=\"").append(url)
+          .append("\" title=\"").append(url)
+          .append("\"><span class=\"RWLink\">").append(url)
+          .append("</span></a></span>").append(start_rwsnippet);
+}
+
+/**
+ * @brief appendLinkedText
+ * Appends the text to the result, with each URL in it replaced by a link.
+ * The output is the same as replacing every match of url_regexp, but most text doesn't contain any URLs:
+ * a match never contains white space, and always contains ':', '@' or "www.",
+ * so the regular expression is only used on the words which contain one of those.
+ * @param result
+ * @param text the (already escaped) text
+ * @param start_rwsnippet the start of the span of text following each link
+ */
+void appendLinkedText(QString &result, const QString &text, const QString &start_rwsnippet)
+{
+    // QRegExp records the last match, so each call needs its own copy (which is only made if needed)
+    QScopedPointer<QRegExp> regexp;
+    const int length = text.size();
+    int done = 0;
+    int start = 0;
+    while (start < length)
+    {
+        if (text.at(start).isSpace())
+        {
+            start++;
+            continue;
+        }
+        // Find the end of the word, and whether it might contain a URL
+        bool candidate = false;
+        int end = start;
+        for (; end < length && !text.at(end).isSpace(); end++)
+        {
+            const QChar ch = text.at(end);
+            if (ch == ':' || ch == '@' || (ch == 'w' && text.midRef(end, 4) == QLatin1String("www.")))
+                candidate = true;
+        }
+        if (candidate)
+        {
+            if (regexp.isNull()) regexp.reset(new QRegExp(url_regexp));
+            const QString word = text.mid(start, end - start);
+            int pos = 0;
+            while ((pos = regexp->indexIn(word, pos)) >= 0)
+            {
+                result.append(text.midRef(done, start + pos - done));
+                append_link(result, word.midRef(pos, regexp->matchedLength()), start_rwsnippet);
+                pos += regexp->matchedLength();
+                done = start + pos;
+            }
+        }
+        start = end;
+    }
+    result.append(text.midRef(done));
+}
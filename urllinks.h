@@ -0,0 +1,30 @@
+#ifndef URLLINKS_H
+#define URLLINKS_H
+
+/*
+RWImporter
+Copyright (C) 2020 Martin Smith
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QString>
+#include <QStringRef>
+
+// Turning the URLs in snippet text into links (see RWContentsItem::xmlSpan)
+
+extern bool mayContainUrl(const QStringRef &text);
+extern void appendLinkedText(QString &result, const QString &text, const QString &start_rwsnippet);
+
+#endif // URLLINKS_H